@@ -0,0 +1,372 @@
+#include "bar.h"
+#include "utils.h"
+#include <X11/Xutil.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The printable ASCII range, anything else is drawn as a question mark
+#define FIRST_GLYPH ' '
+#define LAST_GLYPH '~'
+#define TOTAL_GLYPHS (LAST_GLYPH - FIRST_GLYPH + 1)
+// Space above and below the text, in pixels
+#define BAR_PADDING 2
+
+static bool is_local_display(Display *conn)
+{
+    // ":0" and "unix:0" share our memory, "host:0" does not
+    const char *name = DisplayString(conn);
+    return name[0] == ':' || strncmp(name, "unix:", 5) == 0;
+}
+
+bool bar_load_theme(bar_theme_t *theme, Display *conn, const char *font_name,
+                    unsigned long foreground, unsigned long background,
+                    unsigned long highlight, unsigned long inactive)
+{
+    XFontStruct *font = XLoadQueryFont(conn, font_name);
+    if (!font)
+    {
+        log_error("failed to load bar font %s", font_name);
+        return false;
+    }
+
+    theme->glyph_width = font->max_bounds.width;
+    theme->ascent = font->ascent;
+    theme->glyph_height = font->ascent + font->descent;
+    theme->height = theme->glyph_height + 2 * BAR_PADDING;
+
+    theme->foreground = foreground, theme->background = background;
+    theme->highlight = highlight, theme->inactive = inactive;
+
+    // Every glyph is drawn into its own cell of a bitmap, which is then read
+    // back once. This is the only time that the font is ever used
+    const int width = TOTAL_GLYPHS * theme->glyph_width;
+    Pixmap bitmap = XCreatePixmap(conn, DefaultRootWindow(conn), width, theme->glyph_height, 1);
+    GC gc = XCreateGC(conn, bitmap, 0, NULL);
+
+    XSetForeground(conn, gc, 0);
+    XFillRectangle(conn, bitmap, gc, 0, 0, width, theme->glyph_height);
+    XSetForeground(conn, gc, 1);
+    XSetFont(conn, gc, font->fid);
+
+    for (int i = 0; i < TOTAL_GLYPHS; i++)
+    {
+        const char c = FIRST_GLYPH + i;
+        XDrawString(conn, bitmap, gc, i * theme->glyph_width, font->ascent, &c, 1);
+    }
+
+    XImage *image = XGetImage(conn, bitmap, 0, 0, width, theme->glyph_height, 1, XYPixmap);
+    theme->glyphs = calloc(width * theme->glyph_height, 1);
+    if (!theme->glyphs)
+        log_fatal("failed to allocate memory for bar glyphs");
+
+    for (int y = 0; image && y < theme->glyph_height; y++)
+        for (int x = 0; x < width; x++)
+            theme->glyphs[y * width + x] = XGetPixel(image, x, y);
+
+    if (image)
+        XDestroyImage(image);
+    XFreeGC(conn, gc);
+    XFreePixmap(conn, bitmap);
+    XFreeFont(conn, font);
+
+    theme->has_shm = is_local_display(conn) && XShmQueryExtension(conn);
+    theme->completion_event = theme->has_shm ? XShmGetEventBase(conn) + ShmCompletion : -1;
+    return true;
+}
+
+void bar_free_theme(bar_theme_t *theme)
+{
+    free(theme->glyphs);
+    theme->glyphs = NULL;
+}
+
+// Returns false if the image could not be shared, the caller falls back to a private one
+static bool create_shared_image(bar_t *bar, Visual *visual, int depth)
+{
+    const int height = bar->theme->height;
+    bar->image = XShmCreateImage(bar->conn, visual, depth, ZPixmap, NULL, &bar->shm,
+            bar->width, height);
+    if (!bar->image)
+        return false;
+
+    bar->shm.shmid = shmget(IPC_PRIVATE, bar->image->bytes_per_line * height, IPC_CREAT | 0600);
+    bar->shm.shmaddr = (bar->shm.shmid == -1) ? (char*) -1 : shmat(bar->shm.shmid, NULL, 0);
+    bar->shm.readOnly = true;
+
+    if (bar->shm.shmaddr == (char*) -1 || !XShmAttach(bar->conn, &bar->shm))
+    {
+        if (bar->shm.shmaddr != (char*) -1)
+            shmdt(bar->shm.shmaddr);
+        if (bar->shm.shmid != -1)
+            shmctl(bar->shm.shmid, IPC_RMID, NULL);
+
+        XDestroyImage(bar->image);
+        bar->shm.shmaddr = NULL;
+        return false;
+    }
+
+    // The segment lives on until everyone detaches, so it can be marked for
+    // removal as soon as the server has attached to it. A crash won't leak it
+    XSync(bar->conn, false);
+    shmctl(bar->shm.shmid, IPC_RMID, NULL);
+
+    bar->image->data = bar->shm.shmaddr;
+    return true;
+}
+
+static void create_image(bar_t *bar)
+{
+    const int screen = DefaultScreen(bar->conn);
+    Visual *visual = DefaultVisual(bar->conn, screen);
+    const int depth = DefaultDepth(bar->conn, screen);
+
+    if (bar->theme->has_shm && create_shared_image(bar, visual, depth))
+        return;
+
+    // Every push will then be copied over the socket instead
+    bar->shm.shmaddr = NULL;
+    bar->image = XCreateImage(bar->conn, visual, depth, ZPixmap, 0, NULL,
+            bar->width, bar->theme->height, 32, 0);
+    if (bar->image)
+        bar->image->data = calloc(bar->image->bytes_per_line, bar->theme->height);
+
+    if (!bar->image || !bar->image->data)
+        log_fatal("failed to allocate memory for bar image");
+}
+
+void bar_open(bar_t *bar, Display *conn, const bar_theme_t *theme, int x, int y, int width)
+{
+    bar->conn = conn;
+    bar->theme = theme;
+    bar->x = x, bar->y = y;
+    bar->width = width;
+    bar->puts_in_flight = 0;
+    bar->is_blank = true;
+
+    XSetWindowAttributes attributes = {
+        .background_pixel = theme->background,
+        // It's ours, so it should never be managed like a client
+        .override_redirect = true,
+        .event_mask = ExposureMask,
+    };
+
+    bar->window = XCreateWindow(conn, DefaultRootWindow(conn), x, y, width, theme->height, 0,
+            CopyFromParent, InputOutput, CopyFromParent,
+            CWBackPixel | CWOverrideRedirect | CWEventMask, &attributes);
+    bar->gc = XCreateGC(conn, bar->window, 0, NULL);
+
+    create_image(bar);
+    XMapRaised(conn, bar->window);
+}
+
+void bar_close(bar_t *bar)
+{
+    if (!bar_is_open(bar))
+        return;
+
+    if (bar->shm.shmaddr)
+    {
+        // The server handles the detach after any put that's still pending
+        XShmDetach(bar->conn, &bar->shm);
+        XDestroyImage(bar->image);
+        shmdt(bar->shm.shmaddr);
+    }
+    else
+    {
+        XDestroyImage(bar->image);
+    }
+
+    XFreeGC(bar->conn, bar->gc);
+    XDestroyWindow(bar->conn, bar->window);
+    bar->window = None;
+}
+
+static inline void put_pixel(XImage *image, int x, int y, unsigned long pixel)
+{
+    static const uint32_t one = 1;
+    const int native_order = *(const uint8_t*) &one ? LSBFirst : MSBFirst;
+
+    // The common case, which does not need to go through a function pointer
+    if (image->bits_per_pixel == 32 && image->byte_order == native_order)
+        ((uint32_t*) (image->data + y * image->bytes_per_line))[x] = pixel;
+    else
+        XPutPixel(image, x, y, pixel);
+}
+
+static void fill(bar_t *bar, int x, int y, int width, int height, unsigned long pixel)
+{
+    for (int j = y; j < y + height; j++)
+        for (int i = x; i < x + width; i++)
+            put_pixel(bar->image, i, j, pixel);
+}
+
+// Whatever does not fit before `limit` is cut off
+static void draw_text(bar_t *bar, int x, int limit, const char *text, unsigned long pixel)
+{
+    const bar_theme_t *theme = bar->theme;
+    const int atlas_width = TOTAL_GLYPHS * theme->glyph_width;
+
+    for (; *text && x + theme->glyph_width <= limit; text++, x += theme->glyph_width)
+    {
+        unsigned char c = *text;
+        if (c < FIRST_GLYPH || c > LAST_GLYPH)
+            c = '?';
+
+        const unsigned char *glyph = theme->glyphs + (c - FIRST_GLYPH) * theme->glyph_width;
+
+        for (int y = 0; y < theme->glyph_height; y++)
+            for (int i = 0; i < theme->glyph_width; i++)
+                if (glyph[y * atlas_width + i])
+                    put_pixel(bar->image, x + i, BAR_PADDING + y, pixel);
+    }
+}
+
+/*
+ * From left to right: a cell per workspace, the title of the focused window
+ * and the status text, which is aligned to the right edge. The title takes
+ * up whatever the status leaves over.
+ */
+static inline int cell_width(const bar_t *bar)
+{
+    return 3 * bar->theme->glyph_width;
+}
+
+static int status_x(const bar_t *bar, const bar_state_t *state)
+{
+    const int width = (strlen(state->status) + 1) * bar->theme->glyph_width;
+    return MAX(MAX_BAR_WORKSPACES * cell_width(bar), bar->width - width);
+}
+
+static void paint_workspace(bar_t *bar, const bar_state_t *state, int i)
+{
+    const bar_theme_t *theme = bar->theme;
+    const int x = i * cell_width(bar);
+
+    unsigned long background = theme->background;
+    if (state->visible_workspace == i)
+        background = state->is_active ? theme->highlight : theme->inactive;
+
+    fill(bar, x, 0, cell_width(bar), theme->height, background);
+
+    const char label[] = { '1' + i, '\0' };
+    draw_text(bar, x + theme->glyph_width, x + cell_width(bar), label, theme->foreground);
+
+    // A small square in the corner, just like dwm
+    if (state->occupied & (1 << i))
+        fill(bar, x + 1, 1, 3, 3, theme->foreground);
+}
+
+static void paint_title(bar_t *bar, const bar_state_t *state, int from, int to)
+{
+    fill(bar, from, 0, to - from, bar->theme->height, bar->theme->background);
+    draw_text(bar, from + bar->theme->glyph_width, to, state->title, bar->theme->foreground);
+}
+
+static void paint_status(bar_t *bar, const bar_state_t *state, int from)
+{
+    fill(bar, from, 0, bar->width - from, bar->theme->height, bar->theme->background);
+    draw_text(bar, from, bar->width, state->status, bar->theme->foreground);
+}
+
+static bool has_workspace_changed(const bar_state_t *old, const bar_state_t *new, int i)
+{
+    const bool was_visible = (old->visible_workspace == i);
+    const bool is_visible = (new->visible_workspace == i);
+
+    return ((old->occupied ^ new->occupied) & (1 << i)) || was_visible != is_visible ||
+        (is_visible && old->is_active != new->is_active);
+}
+
+static void push(bar_t *bar, int x, int y, int width, int height)
+{
+    if (bar->shm.shmaddr)
+    {
+        // The server reads the image whenever it gets to the request, and
+        // tells us through a ShmCompletion event once it's done
+        XShmPutImage(bar->conn, bar->window, bar->gc, bar->image,
+                x, y, x, y, width, height, true);
+        bar->puts_in_flight++;
+    }
+    else
+    {
+        // Copied into the request right away, the image is free to change
+        XPutImage(bar->conn, bar->window, bar->gc, bar->image, x, y, x, y, width, height);
+    }
+}
+
+// Repaints the parts of the image that differ, and pushes their bounding span
+static void redraw(bar_t *bar)
+{
+    const bar_state_t *old = &bar->drawn;
+    const bar_state_t *new = &bar->wanted;
+    int damage_from = bar->width, damage_to = 0;
+
+    for (int i = 0; i < MAX_BAR_WORKSPACES; i++)
+    {
+        if (!bar->is_blank && !has_workspace_changed(old, new, i))
+            continue;
+
+        paint_workspace(bar, new, i);
+        damage_from = MIN(damage_from, i * cell_width(bar));
+        damage_to = MAX(damage_to, (i + 1) * cell_width(bar));
+    }
+
+    const int title_x = MAX_BAR_WORKSPACES * cell_width(bar);
+    const int old_status_x = status_x(bar, old);
+    const int new_status_x = status_x(bar, new);
+    // A longer or shorter status moves the border between the two
+    const bool has_moved = bar->is_blank || old_status_x != new_status_x;
+
+    if (has_moved || strcmp(old->title, new->title) != 0)
+    {
+        paint_title(bar, new, title_x, new_status_x);
+        damage_from = MIN(damage_from, title_x);
+        damage_to = MAX(damage_to, new_status_x);
+    }
+
+    if (has_moved || strcmp(old->status, new->status) != 0)
+    {
+        paint_status(bar, new, new_status_x);
+        damage_from = MIN(damage_from, new_status_x);
+        damage_to = bar->width;
+    }
+
+    bar->drawn = bar->wanted;
+    bar->is_blank = false;
+
+    if (damage_from < damage_to)
+        push(bar, damage_from, 0, damage_to - damage_from, bar->theme->height);
+}
+
+void bar_update(bar_t *bar, const bar_state_t *state)
+{
+    if (!bar_is_open(bar))
+        return;
+
+    bar->wanted = *state;
+
+    // Drawing now could tear the image that the server is reading, so the
+    // update waits for bar_handle_completion()
+    if (bar->puts_in_flight == 0)
+        redraw(bar);
+}
+
+void bar_handle_expose(bar_t *bar, const XExposeEvent *event)
+{
+    // The first redraw is going to push everything anyway
+    if (bar->is_blank)
+        return;
+
+    // The image always holds a complete frame, so nothing has to be painted
+    push(bar, event->x, event->y, event->width, event->height);
+}
+
+void bar_handle_completion(bar_t *bar)
+{
+    // Only draws if something changed in the meantime
+    if (--bar->puts_in_flight == 0)
+        redraw(bar);
+}
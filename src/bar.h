@@ -0,0 +1,91 @@
+#ifndef _WM_BAR_H
+#define _WM_BAR_H
+
+#include <stdbool.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+#include "clients.h"
+
+/*
+ * A status bar along the top edge of a monitor, showing its workspaces, the
+ * title of its focused window and the name of the root window (which is how
+ * scripts such as `xsetroot -name` hand us their status text).
+ *
+ * The bar is drawn on our side, into an image that is shared with the server
+ * through MIT-SHM, so pushing it costs no copying over the socket. Text is
+ * rendered from a glyph atlas that is captured once from a core X font.
+ * Every update is compared against what the image already holds, and only
+ * the part that actually changed is repainted and pushed. Nothing is drawn
+ * at all while the state stays the same. There's a single image, so while
+ * the server is still reading it, further updates wait for ShmCompletion.
+ */
+#define MAX_BAR_WORKSPACES 9
+#define MAX_STATUS_LENGTH 256
+
+// What a bar shows, the text is always NUL padded so that it can be compared
+typedef struct
+{
+    // Bit i is set when workspace i holds any clients
+    unsigned int occupied;
+    int visible_workspace;
+    // Whether the monitor has the keyboard focus
+    bool is_active;
+    char title[MAX_TITLE_LENGTH];
+    char status[MAX_STATUS_LENGTH];
+} bar_state_t;
+
+// Shared by the bars of all monitors
+typedef struct
+{
+    // Coverage of the printable ASCII range, one byte per pixel
+    unsigned char *glyphs;
+    int glyph_width, glyph_height, ascent;
+    int height;
+
+    unsigned long foreground, background, highlight, inactive;
+    // Left to false for remote servers, which can't map our memory
+    bool has_shm;
+    // ShmCompletion is numbered at runtime, just like the rest of the extension events
+    int completion_event;
+} bar_theme_t;
+
+typedef struct
+{
+    Display *conn;
+    const bar_theme_t *theme;
+    // None while the bar is closed
+    Window window;
+    GC gc;
+    int x, y, width;
+
+    XImage *image;
+    XShmSegmentInfo shm;
+    // Puts that the server has not finished reading, the image can't be drawn on
+    int puts_in_flight;
+    bool is_blank;
+
+    // What the image currently holds, and what it should hold
+    bar_state_t drawn, wanted;
+} bar_t;
+
+// Returns false if the font could not be loaded, in which case no bar is shown
+bool bar_load_theme(bar_theme_t *theme, Display *conn, const char *font,
+                    unsigned long foreground, unsigned long background,
+                    unsigned long highlight, unsigned long inactive);
+void bar_free_theme(bar_theme_t *theme);
+
+void bar_open(bar_t *bar, Display *conn, const bar_theme_t *theme, int x, int y, int width);
+void bar_close(bar_t *bar);
+
+static inline bool bar_is_open(const bar_t *bar)
+{
+    return bar->window != None;
+}
+
+// Repaints and pushes whatever differs from the current contents
+void bar_update(bar_t *bar, const bar_state_t *state);
+void bar_handle_expose(bar_t *bar, const XExposeEvent *event);
+// The server is done with the image, any update that was held back is drawn now
+void bar_handle_completion(bar_t *bar);
+
+#endif
@@ -3,27 +3,156 @@
 #include <assert.h>
 #include <stdlib.h>
 
-client_t* create_client(Window window)
+/*
+ * Clients are carved out of slabs and recycled through a free list, so that
+ * mapping and destroying windows never has to go through malloc. Slabs are
+ * kept around for the whole lifetime of the window manager.
+ */
+#define CLIENTS_PER_SLAB 64
+
+// Free clients are chained through their `next` pointer
+static client_t *free_clients = NULL;
+
+static void grow_pool(void)
 {
-    client_t *c = malloc(sizeof(client_t));
-    if (!c)
+    client_t *slab = malloc(CLIENTS_PER_SLAB * sizeof(client_t));
+    if (!slab)
         log_fatal("failed to allocate memory for client");
 
+    for (int i = 0; i < CLIENTS_PER_SLAB; i++)
+    {
+        slab[i].next = free_clients;
+        free_clients = &slab[i];
+    }
+}
+
+client_t* create_client(Window window)
+{
+    if (!free_clients)
+        grow_pool();
+
+    client_t *c = free_clients;
+    free_clients = c->next;
+
     c->previous = NULL;
     c->next = NULL;
     c->window = window;
     // Initialize everything to negative one to mark them as disabled
     c->min_width = c->max_width = -1;
     c->min_height = c->max_height = -1;
+    c->window_type = None;
+    c->is_transient = false;
+    c->protocols = 0;
+    c->title[0] = '\0';
+    c->x = c->y = c->width = c->height = -1;
+    c->sync_counter = c->sync_alarm = None;
+    c->sync_value = 0;
+    c->is_awaiting_sync = c->has_pending_geometry = false;
+    c->ignored_unmaps = 0;
+    c->focus_next = c->focus_previous = NULL;
+    c->list = NULL;
+    c->bucket_next = NULL;
+    c->is_floating = false;
 
     return c;
 }
 
-void clients_initialize(client_list_t *list)
+void destroy_client(client_t *client)
+{
+    client->next = free_clients;
+    free_clients = client;
+}
+
+// The initial bucket count, doubled whenever there are more clients than buckets
+#define INITIAL_BUCKETS 64
+
+// Fibonacci hashing, window IDs tend to only differ in their lower bits
+static inline unsigned int hash_window(const client_index_t *index, Window window)
 {
-    list->head = NULL;
+    return (unsigned int) ((window * 11400714819323198485llu) >> 32) & (index->total_buckets - 1);
+}
+
+static void allocate_buckets(client_index_t *index, unsigned int total_buckets)
+{
+    index->buckets = calloc(total_buckets, sizeof(client_t*));
+    if (!index->buckets)
+        log_fatal("failed to allocate memory for window index");
+
+    index->total_buckets = total_buckets;
+}
+
+void clients_index_initialize(client_index_t *index)
+{
+    allocate_buckets(index, INITIAL_BUCKETS);
+    index->length = 0;
+}
+
+void clients_index_destroy(client_index_t *index)
+{
+    free(index->buckets);
+    index->buckets = NULL;
+}
+
+static void index_add(client_index_t *index, client_t *client)
+{
+    unsigned int bucket = hash_window(index, client->window);
+
+    client->bucket_next = index->buckets[bucket];
+    index->buckets[bucket] = client;
+}
+
+static void index_grow(client_index_t *index)
+{
+    client_t **old_buckets = index->buckets;
+    unsigned int old_total = index->total_buckets;
+
+    allocate_buckets(index, old_total * 2);
+
+    // Re-distribute every chain over the new buckets
+    for (unsigned int i = 0; i < old_total; i++)
+    {
+        client_t *next;
+        for (client_t *c = old_buckets[i]; c; c = next)
+        {
+            next = c->bucket_next;
+            index_add(index, c);
+        }
+    }
+
+    free(old_buckets);
+}
+
+static void index_insert(client_index_t *index, client_t *client)
+{
+    if (index->length == index->total_buckets)
+        index_grow(index);
+
+    index_add(index, client);
+    index->length++;
+}
+
+static void index_remove(client_index_t *index, client_t *client)
+{
+    client_t **link = &index->buckets[hash_window(index, client->window)];
+
+    // Walk the chain until we find the link pointing to our client
+    while (*link && *link != client)
+        link = &(*link)->bucket_next;
+
+    if (*link)
+    {
+        *link = client->bucket_next;
+        client->bucket_next = NULL;
+        index->length--;
+    }
+}
+
+void clients_initialize(client_list_t *list, client_index_t *index)
+{
+    list->head = list->tail = NULL;
     list->length = 0;
     list->focus_stack = NULL;
+    list->index = index;
 }
 
 void clients_insert(client_list_t *list, client_t *client)
@@ -39,6 +168,9 @@ void clients_insert(client_list_t *list, client_t *client)
         
     list->head = client;
     list->length++;
+
+    client->list = list;
+    index_insert(list->index, client);
 }
 
 void clients_remove_client(client_list_t *list, client_t *client)
@@ -61,6 +193,9 @@ void clients_remove_client(client_list_t *list, client_t *client)
     // we can't just leave it into an invalid state
     client->next = client->previous = NULL;
     list->length--;
+
+    client->list = NULL;
+    index_remove(list->index, client);
 }
 
 void clients_destroy_client(client_list_t *list, client_t *client)
@@ -68,16 +203,13 @@ void clients_destroy_client(client_list_t *list, client_t *client)
     clients_remove_client(list, client);
     // Remove from focus stack as well, automatically!
     clients_remove_focus(list, client);
-    free(client);
+    destroy_client(client);
 }
 
-client_t* clients_find_by_window(const client_list_t *list, Window window)
+client_t* clients_find_by_window(const client_index_t *index, Window window)
 {
-    if (list->head == NULL)
-        return NULL;
-
-    // Just return the first match, performing a linear search
-    for (client_t *c = list->head; c != NULL; c = c->next)
+    // Only the clients that share the same bucket have to be compared
+    for (client_t *c = index->buckets[hash_window(index, window)]; c; c = c->bucket_next)
         if (c->window == window)
             return c;
 
@@ -86,57 +218,33 @@ client_t* clients_find_by_window(const client_list_t *list, Window window)
 
 client_t* clients_get_focused(client_list_t *list)
 {
-    if (!list->focus_stack) return NULL;
-    return list->focus_stack->client;
+    return list->focus_stack;
 }
 
-// A private method that removes the specified element from the singly linked list
-static focus_stack_t* remove_from_focus(client_list_t *list, client_t *c)
+void clients_remove_focus(client_list_t *list, client_t *c)
 {
-    if (!list->focus_stack) return NULL;
-
     // If it's the root, be careful
-    if (list->focus_stack->client == c)
-    {
-        focus_stack_t *temp = list->focus_stack;
-        list->focus_stack = temp->next;
-        return temp;
-    }
-
-    focus_stack_t *prev = list->focus_stack;
-    for (focus_stack_t *f = prev->next; f; f = f->next)
-    {
-        if (f->client == c)
-        {
-            // Just jump over the current node, effectively deleting it
-            prev->next = f->next;
-            return f;
-        }
+    if (c->focus_previous)
+        c->focus_previous->focus_next = c->focus_next;
+    else if (list->focus_stack == c)
+        list->focus_stack = c->focus_next;
+    else
+        return; // The client has never been focused
 
-        prev = f;
-    }
+    if (c->focus_next)
+        c->focus_next->focus_previous = c->focus_previous;
 
-    return NULL;
-}
-
-void clients_remove_focus(client_list_t *list, client_t *c)
-{
-    // Free up the heap-allocated memory as well
-    free(remove_from_focus(list, c));
+    c->focus_next = c->focus_previous = NULL;
 }
 
 void clients_push_focus(client_list_t *list, client_t *c)
 {
-    focus_stack_t *item = remove_from_focus(list, c);
+    // Resurface the old entry, if there is one
+    clients_remove_focus(list, c);
 
-    // If the item was not already inside the stack, create it
-    if (item == NULL)
-    {
-        item = malloc(sizeof(focus_stack_t));
-        assert(item);
-        item->client = c;
-    }
+    c->focus_next = list->focus_stack;
+    if (list->focus_stack)
+        list->focus_stack->focus_previous = c;
 
-    item->next = list->focus_stack;
-    list->focus_stack = item;
+    list->focus_stack = c;
 }
@@ -2,7 +2,21 @@
 #define _WM_CLIENTS_H
 
 #include <stdbool.h>
-#include <X11/Xutil.h>
+// Only the protocol types are needed, so this module can be built without Xlib
+#include <X11/X.h>
+
+// WM_PROTOCOLS that a client might participate in, used as bit indices
+typedef enum
+{
+    PROTOCOL_DELETE_WINDOW,
+    PROTOCOL_TAKE_FOCUS,
+    // _NET_WM_SYNC_REQUEST, listed among WM_PROTOCOLS even though it's EWMH
+    PROTOCOL_SYNC_REQUEST,
+    TOTAL_PROTOCOLS,
+} client_protocol_e;
+
+// Longer WM_NAMEs are cut short, nothing ever shows more than this
+#define MAX_TITLE_LENGTH 128
 
 /*
  * A doubly-linked list of all top-level windows that our WM is responsible of
@@ -17,18 +31,62 @@ typedef struct client_t
     // These will be left to -1 when disabled
     int min_width, min_height;
     int max_width, max_height;
+    // _NET_WM_WINDOW_TYPE, or None if the client did not bother to set it
+    Atom window_type;
+    bool is_transient;
+    // Bitmask of supported client_protocol_e values, kept fresh by PropertyNotify
+    unsigned int protocols;
+    // WM_NAME, always NUL terminated
+    char title[MAX_TITLE_LENGTH];
+
+    // The geometry that the server last knew of, used to skip redundant
+    // configure requests. Left to -1 until the window is first positioned
+    int x, y, width, height;
+
+    // _NET_WM_SYNC_REQUEST_COUNTER, an XSync counter that the client bumps
+    // once it has repainted for a new size. None if it has none
+    XID sync_counter;
+    // Fires when the counter reaches sync_value, None while not syncing
+    XID sync_alarm;
+    long long sync_value;
+    // While the client is still busy repainting, only the latest geometry is
+    // kept around, it's sent out once the client catches up
+    bool is_awaiting_sync;
+    long long sync_deadline;
+    bool has_pending_geometry;
+    int pending_x, pending_y, pending_width, pending_height;
+
+    // Unmap events that were caused by us, and should thus not be taken as withdrawal
+    int ignored_unmaps;
 
     struct client_t *next;
     struct client_t *previous;
+
+    // Neighbours within the focus stack, embedded so that no allocation is needed
+    struct client_t *focus_next;
+    struct client_t *focus_previous;
+
+    // The list that currently holds the client, NULL if it's not inserted anywhere
+    struct client_list_t *list;
+    // Next client within the same bucket of the window index
+    struct client_t *bucket_next;
 } client_t;
 
-typedef struct focus_stack_t
+/*
+ * A hash map from windows to their clients. It's shared between the lists of
+ * all workspaces, so that any window can be found in constant time, no matter
+ * which workspace it currently lives in. Collisions are chained through the
+ * clients themselves, so no extra memory is needed per entry.
+ */
+typedef struct
 {
-    client_t *client;
-    struct focus_stack_t *next;
-} focus_stack_t;
+    client_t **buckets;
+    // Always a power of two
+    unsigned int total_buckets;
+    int length;
+} client_index_t;
 
-typedef struct
+typedef struct client_list_t
 {
     client_t *head;
     // Storing last item for faster access
@@ -37,10 +95,17 @@ typedef struct
 
     // We need some sort of memory of previously focused windows.
     // Predictability is important, and the user is expecting stack-like behaviour
-    focus_stack_t *focus_stack;
+    // The most recently focused client sits on top, linked through focus_next
+    client_t *focus_stack;
+
+    // Kept up to date automatically on every insertion and removal
+    client_index_t *index;
 } client_list_t;
 
-void clients_initialize(client_list_t *list);
+void clients_index_initialize(client_index_t *index);
+void clients_index_destroy(client_index_t *index);
+
+void clients_initialize(client_list_t *list, client_index_t *index);
 
 void clients_insert(client_list_t *list, client_t *client);
 // NOTE: Will just remove it from the list, you need to destroy it yourself!
@@ -48,14 +113,17 @@ void clients_remove_client(client_list_t *list, client_t *client);
 // Will remove from list and then actually free up the resources
 void clients_destroy_client(client_list_t *list, client_t *client);
 
+// Clients are handed out by a pool, they should only ever be released through this
 client_t* create_client(Window window);
+void destroy_client(client_t *client);
 
-// Returns NULL upon search failure
-client_t* clients_find_by_window(const client_list_t *list, Window window);
+// Searches all lists that share the index. Returns NULL upon search failure
+client_t* clients_find_by_window(const client_index_t *index, Window window);
 
 client_t* clients_get_focused(client_list_t *list);
 
 // Will automatically resurface old entry if it already exists
+// Both of these run in constant time
 void clients_push_focus(client_list_t *list, client_t *c);
 void clients_remove_focus(client_list_t *list, client_t *c);
 
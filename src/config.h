@@ -9,6 +9,17 @@
 
 #define WM_BORDER_WIDTH 1
 #define WM_INITIAL_GAP 10
+// Moving or resizing a window will update its geometry at most this many times per second
+#define WM_DRAG_REFRESH_RATE 60
+// Clients that take longer to repaint after a resize are no longer waited on
+#define WM_SYNC_TIMEOUT_MS 200
+
+// An optional bar on top of every monitor, which takes its height away from
+// the tiled windows. Its status text is the name of the root window, which
+// can be set through `xsetroot -name`
+#define WM_SHOW_BAR false
+// Any core X font, `xlsfonts` lists them
+#define WM_BAR_FONT "fixed"
 
 #define SWITCH_WORK(k, n)                                                  \
     { {WM_MOD_MASK, k}, wm_switch_to_workspace, {.amount = n} },           \
@@ -22,6 +33,7 @@ static wm_key_t wm_kill_client_key = { WM_MOD_MASK | ShiftMask, XK_q };
 
 static wm_binding_t wm_bindings[] = {
     { {WM_MOD_MASK | ShiftMask, XK_e}, wm_quit, NULL },
+    { {WM_MOD_MASK | ShiftMask, XK_r}, wm_restart, NULL },
     { {WM_MOD_MASK, XK_equal}, wm_reset_special_width },
 
     { {WM_MOD_MASK, XK_l}, wm_adjust_special_width, {.amount = 20} },
@@ -29,6 +41,8 @@ static wm_binding_t wm_bindings[] = {
     { {WM_MOD_MASK, XK_j}, wm_focus_on_next, NULL},
     { {WM_MOD_MASK, XK_k}, wm_focus_on_previous, NULL},
     { {WM_MOD_MASK, XK_Return}, wm_make_focused_special, NULL},
+    { {WM_MOD_MASK, XK_period}, wm_focus_monitor, {.amount = 1} },
+    { {WM_MOD_MASK, XK_comma}, wm_focus_monitor, {.amount = -1} },
 
     // Workspace switching bindings, this is going to be repetitive
     SWITCH_WORK(XK_1, 0), SWITCH_WORK(XK_2, 1), SWITCH_WORK(XK_3, 2),
@@ -36,6 +50,8 @@ static wm_binding_t wm_bindings[] = {
     SWITCH_WORK(XK_7, 6), SWITCH_WORK(XK_8, 7), SWITCH_WORK(XK_9, 8),
 
     { {WM_MOD_MASK, XK_t}, wm_toggle_float },
+    { {WM_MOD_MASK, XK_space}, wm_cycle_layout, {.amount = 1} },
+    { {WM_MOD_MASK | ShiftMask, XK_space}, wm_cycle_layout, {.amount = -1} },
     { {WM_MOD_MASK | ShiftMask, XK_equal}, wm_adjust_gap, {.amount = 1} },
     { {WM_MOD_MASK, XK_minus}, wm_adjust_gap, {.amount = -1} },
 
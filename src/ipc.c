@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+#include "ipc.h"
+#include "utils.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <libgen.h>
+#include <string.h>
+#include <unistd.h>
+
+static void watch(ipc_server_t *server, int fd, int operation, unsigned int events)
+{
+    struct epoll_event event = { .events = events, .data.fd = fd };
+
+    if (epoll_ctl(server->epoll_fd, operation, fd, &event) == -1)
+        log_fatal("failed to watch IPC socket %d", fd);
+}
+
+// Owned by us and closed to everyone else, like XDG_RUNTIME_DIR has to be
+static bool is_private_directory(const char *path)
+{
+    char copy[sizeof(((ipc_server_t*) 0)->path)];
+    snprintf(copy, sizeof(copy), "%s", path);
+
+    struct stat info;
+    return stat(dirname(copy), &info) == 0 && S_ISDIR(info.st_mode) &&
+        info.st_uid == getuid() && !(info.st_mode & (S_IRWXG | S_IRWXO));
+}
+
+void ipc_open(ipc_server_t *server, int epoll_fd, const char *path)
+{
+    server->epoll_fd = epoll_fd;
+    server->total_clients = 0;
+    server->listen_fd = -1;
+    if (!path)
+        return;
+
+    snprintf(server->path, sizeof(server->path), "%s", path);
+    if (!is_private_directory(server->path))
+    {
+        log_error("refusing to open IPC socket at %s, its directory is not private", path);
+        return;
+    }
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    memcpy(address.sun_path, server->path, sizeof(address.sun_path));
+
+    // A previous instance (or a crash) might have left its socket behind
+    unlink(server->path);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    // The socket is created by bind(), so it has to be private from the start
+    const mode_t old_umask = umask(077);
+    const bool is_bound = server->listen_fd != -1 &&
+        bind(server->listen_fd, (struct sockaddr*) &address, sizeof(address)) == 0;
+    umask(old_umask);
+
+    // The WM is perfectly usable without it, so this is not fatal
+    if (!is_bound || chmod(server->path, 0600) == -1 ||
+        listen(server->listen_fd, MAX_IPC_CLIENTS) == -1)
+    {
+        log_error("failed to open IPC socket at %s: %s", server->path, strerror(errno));
+        if (server->listen_fd != -1)
+            close(server->listen_fd);
+        if (is_bound)
+            unlink(server->path);
+
+        server->listen_fd = -1;
+        return;
+    }
+
+    watch(server, server->listen_fd, EPOLL_CTL_ADD, EPOLLIN);
+}
+
+void ipc_close(ipc_server_t *server)
+{
+    if (server->listen_fd == -1)
+        return;
+
+    for (int i = 0; i < server->total_clients; i++)
+        if (server->clients[i].fd != -1)
+            close(server->clients[i].fd);
+
+    close(server->listen_fd);
+    unlink(server->path);
+}
+
+bool ipc_owns(const ipc_server_t *server, int fd)
+{
+    if (fd == server->listen_fd)
+        return true;
+
+    for (int i = 0; i < server->total_clients; i++)
+        if (server->clients[i].fd == fd)
+            return true;
+
+    return false;
+}
+
+// Clients are only marked here, they are removed by remove_disconnected()
+static void disconnect(ipc_client_t *client)
+{
+    // Closing the socket removes it from the epoll set as well
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void remove_disconnected(ipc_server_t *server)
+{
+    int total = 0;
+    for (int i = 0; i < server->total_clients; i++)
+        if (server->clients[i].fd != -1)
+            server->clients[total++] = server->clients[i];
+
+    server->total_clients = total;
+}
+
+static void accept_clients(ipc_server_t *server)
+{
+    int fd;
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        if (server->total_clients == MAX_IPC_CLIENTS)
+        {
+            close(fd);
+            continue;
+        }
+
+        ipc_client_t *client = &server->clients[server->total_clients++];
+        client->fd = fd;
+        client->is_subscribed = false;
+        client->input_length = client->output_length = 0;
+
+        watch(server, fd, EPOLL_CTL_ADD, EPOLLIN);
+    }
+}
+
+static void read_commands(ipc_server_t *server, ipc_client_t *client,
+                          ipc_handler_t handler, void *data)
+{
+    for (;;)
+    {
+        ssize_t total = read(client->fd, client->input + client->input_length,
+                IPC_BUFFER_SIZE - client->input_length);
+
+        if (total == 0 || (total == -1 && errno != EAGAIN && errno != EINTR))
+            return disconnect(client);
+        if (total == -1)
+            return;
+
+        client->input_length += total;
+
+        // Hand over every complete line, keeping the rest for later
+        char *line = client->input;
+        char *end;
+        while (client->fd != -1 &&
+               (end = memchr(line, '\n', client->input + client->input_length - line)))
+        {
+            *end = '\0';
+            handler(data, client, line);
+            line = end + 1;
+        }
+
+        if (client->fd == -1)
+            return;
+
+        client->input_length -= line - client->input;
+        memmove(client->input, line, client->input_length);
+
+        // There's no way to make sense of a line this long
+        if (client->input_length == IPC_BUFFER_SIZE)
+            return disconnect(client);
+    }
+}
+
+// Returns false if the client had to be disconnected
+static bool send_output(ipc_server_t *server, ipc_client_t *client)
+{
+    // MSG_NOSIGNAL, a client that went away should not kill us through SIGPIPE
+    ssize_t total = send(client->fd, client->output, client->output_length,
+            MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (total == -1 && errno != EAGAIN && errno != EINTR)
+    {
+        disconnect(client);
+        return false;
+    }
+
+    if (total > 0)
+    {
+        client->output_length -= total;
+        memmove(client->output, client->output + total, client->output_length);
+    }
+
+    // Only wake up for writes while there's something left to write
+    watch(server, client->fd, EPOLL_CTL_MOD,
+            client->output_length ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    return true;
+}
+
+void ipc_handle(ipc_server_t *server, int fd, unsigned int events,
+                ipc_handler_t handler, void *data)
+{
+    if (fd == server->listen_fd)
+        return accept_clients(server);
+
+    for (int i = 0; i < server->total_clients; i++)
+    {
+        ipc_client_t *client = &server->clients[i];
+        if (client->fd != fd)
+            continue;
+
+        if ((events & EPOLLOUT) && !send_output(server, client))
+            break;
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            read_commands(server, client, handler, data);
+
+        break;
+    }
+
+    remove_disconnected(server);
+}
+
+static void append(ipc_client_t *client, const char *format, va_list args)
+{
+    if (client->fd == -1)
+        return;
+
+    const int space = IPC_BUFFER_SIZE - client->output_length;
+    const int length = vsnprintf(client->output + client->output_length, space, format, args);
+
+    // Too slow to keep up with its own buffer, it will just have to reconnect
+    if (length < 0 || length >= space)
+        return disconnect(client);
+
+    client->output_length += length;
+}
+
+void ipc_reply(ipc_client_t *client, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    append(client, format, args);
+    va_end(args);
+}
+
+void ipc_broadcast(ipc_server_t *server, const char *format, ...)
+{
+    for (int i = 0; i < server->total_clients; i++)
+    {
+        if (!server->clients[i].is_subscribed)
+            continue;
+
+        va_list args;
+        va_start(args, format);
+        append(&server->clients[i], format, args);
+        va_end(args);
+    }
+}
+
+void ipc_flush(ipc_server_t *server)
+{
+    for (int i = 0; i < server->total_clients; i++)
+    {
+        ipc_client_t *client = &server->clients[i];
+
+        if (client->fd != -1 && client->output_length)
+            send_output(server, client);
+    }
+
+    remove_disconnected(server);
+}
@@ -0,0 +1,62 @@
+#ifndef _WM_IPC_H
+#define _WM_IPC_H
+
+#include <stdbool.h>
+#include <sys/un.h>
+
+/*
+ * A Unix domain socket that scripts and status bars can talk to, without
+ * going through the X server. The protocol is line based: every line is a
+ * command, which is answered by a single line. Clients that subscribe are
+ * then sent a line for every change of the WM state.
+ *
+ * All sockets are non-blocking and served by the main loop. Output is only
+ * buffered, and sent once per batch by ipc_flush(). A client that can't keep
+ * up with its own buffer is disconnected, it will never block the WM.
+ */
+#define MAX_IPC_CLIENTS 16
+#define IPC_BUFFER_SIZE 4096
+
+typedef struct
+{
+    int fd;
+    bool is_subscribed;
+
+    // A partial line might be left over from the previous read
+    char input[IPC_BUFFER_SIZE];
+    int input_length;
+    // Waiting for the socket to become writable
+    char output[IPC_BUFFER_SIZE];
+    int output_length;
+} ipc_client_t;
+
+typedef struct
+{
+    int listen_fd;
+    // All of our sockets are registered on it, check out ipc_owns()
+    int epoll_fd;
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+
+    ipc_client_t clients[MAX_IPC_CLIENTS];
+    int total_clients;
+} ipc_server_t;
+
+// Called for every complete line, which is no longer than IPC_BUFFER_SIZE
+typedef void (*ipc_handler_t)(void *data, ipc_client_t *client, char *line);
+
+// Only ever listens inside a directory that nobody else can access. Without a
+// path, the server just stays closed and everything else is a no-op
+void ipc_open(ipc_server_t *server, int epoll_fd, const char *path);
+void ipc_close(ipc_server_t *server);
+
+bool ipc_owns(const ipc_server_t *server, int fd);
+// Accepts new clients, reads commands or sends pending output, depending on the fd
+void ipc_handle(ipc_server_t *server, int fd, unsigned int events,
+                ipc_handler_t handler, void *data);
+
+// Both of these are only buffered until the next ipc_flush()
+void ipc_reply(ipc_client_t *client, const char *format, ...);
+void ipc_broadcast(ipc_server_t *server, const char *format, ...);
+void ipc_flush(ipc_server_t *server);
+
+#endif
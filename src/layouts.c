@@ -0,0 +1,214 @@
+#include "layouts.h"
+#include "utils.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// X refuses windows without an area, so no rectangle is ever smaller
+#define MIN_SIZE 1
+
+// How many cells of at least MIN_SIZE fit into a length, with gaps in between
+static int fitting_cells(int length, int gap)
+{
+    return MAX(1, (length + gap) / (MIN_SIZE + gap));
+}
+
+static void master_stack(const layout_params_t *p, int total, layout_rect_t *rects)
+{
+    const int max_width = p->width - 2 * p->gap;
+    const int max_height = p->height - 2 * p->gap;
+
+    if (total == 1)
+    {
+        rects[0] = (layout_rect_t) { p->gap, p->gap, max_width, max_height };
+        return;
+    }
+
+    // The head of the list, also known as the special window,
+    // will capture a whole pane on its own.
+    // It always leaves some room for the stack, even after the gap has grown
+    const int special_width = MAX(MIN_SIZE, MIN(p->special_width, max_width - p->gap - MIN_SIZE));
+    rects[0] = (layout_rect_t) { p->gap, p->gap, special_width, max_height };
+    const int rem_width = max_width - special_width - p->gap;
+
+    // The other windows will just share the remaining space, as long as there's
+    // room for them. Any others overlap the bottom of the stack
+    const int stacked = MIN(total - 1, fitting_cells(max_height, p->gap));
+
+    // x * stacked + gap * (stacked - 1) = max_height, solve for x
+    const int other_height = (max_height - p->gap * (stacked - 1)) / stacked;
+
+    for (int i = 1; i < total; i++)
+    {
+        const int row = MIN(i, stacked) - 1;
+        rects[i] = (layout_rect_t) {
+            special_width + 2 * p->gap, p->gap + row * (p->gap + other_height),
+            rem_width, other_height
+        };
+    }
+}
+
+static void monocle(const layout_params_t *p, int total, layout_rect_t *rects)
+{
+    for (int i = 0; i < total; i++)
+        rects[i] = (layout_rect_t) {
+            p->gap, p->gap, p->width - 2 * p->gap, p->height - 2 * p->gap
+        };
+}
+
+static void grid(const layout_params_t *p, int total, layout_rect_t *rects)
+{
+    // Windows that don't get a cell of their own overlap the last one
+    const int max_columns = fitting_cells(p->width - 2 * p->gap, p->gap);
+    const int max_rows = fitting_cells(p->height - 2 * p->gap, p->gap);
+    const int cells = MIN(total, max_columns * max_rows);
+
+    // As square as possible, with any missing cells at the end of the last row
+    int columns = 1;
+    while (columns * columns < cells)
+        columns++;
+    // A short area runs out of rows first, a narrow one out of columns
+    columns = MIN(MAX(columns, (cells + max_rows - 1) / max_rows), max_columns);
+    const int rows = (cells + columns - 1) / columns;
+
+    const int cell_height = (p->height - p->gap * (rows + 1)) / rows;
+
+    for (int i = 0; i < total; i++)
+    {
+        const int cell = MIN(i, cells - 1);
+        const int row = cell / columns;
+        // The last row might hold fewer windows, which are then stretched
+        const int in_row = (row == rows - 1) ? cells - row * columns : columns;
+        const int cell_width = (p->width - p->gap * (in_row + 1)) / in_row;
+        const int column = cell % columns;
+
+        rects[i] = (layout_rect_t) {
+            p->gap + column * (cell_width + p->gap), p->gap + row * (cell_height + p->gap),
+            cell_width, cell_height
+        };
+    }
+}
+
+static void spiral(const layout_params_t *p, int total, layout_rect_t *rects)
+{
+    int x = p->gap, y = p->gap;
+    int width = p->width - 2 * p->gap, height = p->height - 2 * p->gap;
+
+    for (int i = 0; i < total; i++)
+    {
+        // The last window takes whatever is left, and so does every window
+        // that comes after the area got too small to be split any further
+        const int split_length = (i % 2 == 0) ? width : height;
+        if (i == total - 1 || (split_length - p->gap) / 2 < MIN_SIZE)
+        {
+            for (; i < total; i++)
+                rects[i] = (layout_rect_t) { x, y, width, height };
+            break;
+        }
+
+        // Alternate between vertical and horizontal splits, going around
+        // clockwise: left, top, right, bottom and then left again
+        const bool is_reversed = (i / 2) % 2;
+
+        if (i % 2 == 0)
+        {
+            const int half = (width - p->gap) / 2;
+            rects[i] = (layout_rect_t) { is_reversed ? x + width - half : x, y, half, height };
+
+            x += is_reversed ? 0 : half + p->gap;
+            width -= half + p->gap;
+        }
+        else
+        {
+            const int half = (height - p->gap) / 2;
+            rects[i] = (layout_rect_t) { x, is_reversed ? y + height - half : y, width, half };
+
+            y += is_reversed ? 0 : half + p->gap;
+            height -= half + p->gap;
+        }
+    }
+}
+
+// Must follow the order of layout_e
+static void (*const layouts[TOTAL_LAYOUTS])(const layout_params_t*, int, layout_rect_t*) = {
+    master_stack,
+    monocle,
+    grid,
+    spiral,
+};
+
+static const char *layout_names[TOTAL_LAYOUTS] = {
+    "master-stack",
+    "monocle",
+    "grid",
+    "spiral",
+};
+
+void layout_cache_initialize(layout_cache_t *cache)
+{
+    cache->rects = NULL;
+    cache->capacity = 0;
+    cache->total = -1;
+}
+
+void layout_cache_destroy(layout_cache_t *cache)
+{
+    free(cache->rects);
+    layout_cache_initialize(cache);
+}
+
+/*
+ * A last resort for areas that can't even hold their gaps, e.g. after the gap
+ * has grown past the size of the monitor. Nothing that reaches the server is
+ * ever empty or outside of the area
+ */
+static void fit_into_area(const layout_params_t *p, layout_rect_t *r)
+{
+    r->width = MAX(MIN_SIZE, MIN(r->width, p->width));
+    r->height = MAX(MIN_SIZE, MIN(r->height, p->height));
+    r->x = MAX(0, MIN(r->x, p->width - r->width));
+    r->y = MAX(0, MIN(r->y, p->height - r->height));
+}
+
+static bool are_params_equal(const layout_params_t *a, const layout_params_t *b)
+{
+    return a->width == b->width && a->height == b->height &&
+        a->gap == b->gap && a->special_width == b->special_width;
+}
+
+const layout_rect_t* layout_compute(layout_cache_t *cache, layout_e layout,
+                                    const layout_params_t *params, int total)
+{
+    if (cache->total == total && cache->layout == layout &&
+        are_params_equal(&cache->params, params))
+    {
+        return cache->rects;
+    }
+
+    if (total > cache->capacity)
+    {
+        // Doubling, so that a growing workspace does not reallocate every time
+        const int capacity = MAX(total, 2 * cache->capacity);
+        layout_rect_t *rects = realloc(cache->rects, capacity * sizeof(layout_rect_t));
+        if (!rects)
+            log_fatal("failed to allocate memory for layout");
+
+        cache->rects = rects;
+        cache->capacity = capacity;
+    }
+
+    if (total > 0)
+        layouts[layout](params, total, cache->rects);
+
+    for (int i = 0; i < total; i++)
+        fit_into_area(params, &cache->rects[i]);
+
+    cache->layout = layout;
+    cache->params = *params;
+    cache->total = total;
+    return cache->rects;
+}
+
+const char* layout_name(layout_e layout)
+{
+    return layout_names[layout];
+}
@@ -0,0 +1,64 @@
+#ifndef _WM_LAYOUTS_H
+#define _WM_LAYOUTS_H
+
+/*
+ * Layouts are pure functions: given the number of tiled clients and the
+ * available area, they fill in a rectangle per client, in list order. They
+ * never talk to the server, that's left to tile(), which only commits the
+ * results. This module does not depend on X at all.
+ *
+ * Every rectangle is at least 1x1 and stays within the area. Once windows no
+ * longer fit side by side, the ones left over overlap the last of them.
+ */
+typedef enum
+{
+    // The special window on the left, everything else stacked on the right
+    LAYOUT_MASTER_STACK,
+    // Every window takes up the whole area, only the focused one is visible
+    LAYOUT_MONOCLE,
+    LAYOUT_GRID,
+    // Each window takes half of the area left over by the previous ones
+    LAYOUT_SPIRAL,
+    TOTAL_LAYOUTS,
+} layout_e;
+
+// Relative to the monitor, just like client coordinates
+typedef struct
+{
+    int x, y, width, height;
+} layout_rect_t;
+
+typedef struct
+{
+    // The gap is left around the edges as well as between windows
+    int width, height;
+    int gap;
+    // Only used by the master-stack layout
+    int special_width;
+} layout_params_t;
+
+/*
+ * The rectangles of the last arrangement, which are handed out again as long
+ * as neither the parameters nor the number of clients change
+ */
+typedef struct
+{
+    layout_rect_t *rects;
+    int capacity;
+
+    layout_e layout;
+    layout_params_t params;
+    // Left to -1 until something is computed
+    int total;
+} layout_cache_t;
+
+void layout_cache_initialize(layout_cache_t *cache);
+void layout_cache_destroy(layout_cache_t *cache);
+
+// Returns `total` rectangles, which stay valid until the next call
+const layout_rect_t* layout_compute(layout_cache_t *cache, layout_e layout,
+                                    const layout_params_t *params, int total);
+
+const char* layout_name(layout_e layout);
+
+#endif
@@ -1,10 +1,26 @@
 #include "window_manager.h"
+#include "utils.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-int main()
+int main(int argc, char **argv)
 {
     wm_t w_manager;
 
     wm_setup(&w_manager);
     wm_loop(&w_manager);
     wm_cleanup(&w_manager);
+
+    // The new instance will find our state on the root window
+    if (w_manager.is_restarting)
+    {
+        execvp(argv[0], argv);
+
+        // The binary might have been moved or rebuilt, nobody adopts the clients now
+        log_error("failed to restart the window manager: %s", strerror(errno));
+        wm_cancel_restart(&w_manager);
+        return EXIT_FAILURE;
+    }
 }
@@ -0,0 +1,109 @@
+#include "profile.h"
+
+#ifdef WM_PROFILE
+
+#include "utils.h"
+#include <X11/X.h>
+#include <stdio.h>
+
+// Must follow the order of profile_handler_e
+static const char *handler_names[TOTAL_PROFILED] = {
+    "other_event",
+    "key_press",
+    "mapping_notify",
+    "button_press",
+    "button_release",
+    "configure_request",
+    "map_request",
+    "unmap_notify",
+    "destroy_notify",
+    "property_notify",
+    "enter_notify",
+    "motion_notify",
+    "adopt",
+    "timers",
+    "tile",
+};
+
+profile_scope_t profile_begin(profiler_t *profiler, profile_handler_e handler,
+                              unsigned long next_request)
+{
+    profile_scope_t scope = {
+        .handler = handler,
+        .previous = profiler->current,
+        .start = monotonic_time_us(),
+        .first_request = next_request,
+    };
+
+    profiler->current = handler;
+    return scope;
+}
+
+profile_handler_e profile_handler_of_event(int type)
+{
+    switch (type)
+    {
+        case KeyPress: return PROFILE_KEY_PRESS;
+        case MappingNotify: return PROFILE_MAPPING_NOTIFY;
+        case ButtonPress: return PROFILE_BUTTON_PRESS;
+        case ButtonRelease: return PROFILE_BUTTON_RELEASE;
+        case ConfigureRequest: return PROFILE_CONFIGURE_REQUEST;
+        case MapRequest: return PROFILE_MAP_REQUEST;
+        case UnmapNotify: return PROFILE_UNMAP_NOTIFY;
+        case DestroyNotify: return PROFILE_DESTROY_NOTIFY;
+        case PropertyNotify: return PROFILE_PROPERTY_NOTIFY;
+        case EnterNotify: return PROFILE_ENTER_NOTIFY;
+        case MotionNotify: return PROFILE_MOTION_NOTIFY;
+        default: return PROFILE_OTHER_EVENT;
+    }
+}
+
+static int bucket_of(long long elapsed)
+{
+    int bucket = 0;
+    while (bucket < TOTAL_PROFILE_BUCKETS - 1 && elapsed >= (1LL << bucket))
+        bucket++;
+
+    return bucket;
+}
+
+void profile_end(profiler_t *profiler, const profile_scope_t *scope,
+                 unsigned long next_request)
+{
+    profile_entry_t *entry = &profiler->entries[scope->handler];
+    const long long elapsed = monotonic_time_us() - scope->start;
+
+    entry->calls++;
+    entry->total_us += elapsed;
+    entry->max_us = MAX(entry->max_us, elapsed);
+    entry->requests += next_request - scope->first_request;
+    entry->histogram[bucket_of(elapsed)]++;
+
+    profiler->current = scope->previous;
+}
+
+void profile_report(const profiler_t *profiler)
+{
+    printf("%-18s %8s %8s %8s %8s %8s  histogram (<1us, <2us, <4us, ...)\n",
+           "handler", "calls", "avg_us", "max_us", "req/call", "trips");
+
+    for (int i = 0; i < TOTAL_PROFILED; i++)
+    {
+        const profile_entry_t *entry = &profiler->entries[i];
+        if (!entry->calls)
+            continue;
+
+        printf("%-18s %8lu %8lld %8lld %8.2f %8lu ", handler_names[i],
+               entry->calls, entry->total_us / (long long) entry->calls,
+               entry->max_us, (double) entry->requests / entry->calls,
+               entry->round_trips);
+
+        for (int b = 0; b < TOTAL_PROFILE_BUCKETS; b++)
+            printf(" %lu", entry->histogram[b]);
+        printf("\n");
+    }
+
+    fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef _WM_PROFILE_H
+#define _WM_PROFILE_H
+
+/*
+ * Per-handler instrumentation, only compiled in when building with
+ * `make PROFILE=1`. Every handler records how often it ran, how long it took
+ * (as a histogram with power of two buckets, in microseconds), how many X
+ * requests it generated and how many times it had to block on the server.
+ * The report is printed to stdout whenever the WM receives SIGUSR1.
+ *
+ * Without the flag, the macros below are reduced to the plain calls, so the
+ * regular build does not even pay for reading the clock.
+ */
+typedef enum
+{
+    // Events that we have no handler for
+    PROFILE_OTHER_EVENT,
+    PROFILE_KEY_PRESS,
+    PROFILE_MAPPING_NOTIFY,
+    PROFILE_BUTTON_PRESS,
+    PROFILE_BUTTON_RELEASE,
+    PROFILE_CONFIGURE_REQUEST,
+    PROFILE_MAP_REQUEST,
+    PROFILE_UNMAP_NOTIFY,
+    PROFILE_DESTROY_NOTIFY,
+    PROFILE_PROPERTY_NOTIFY,
+    PROFILE_ENTER_NOTIFY,
+    PROFILE_MOTION_NOTIFY,
+    // Work that does not belong to a single event
+    PROFILE_ADOPT,
+    PROFILE_TIMERS,
+    PROFILE_TILE,
+    TOTAL_PROFILED,
+} profile_handler_e;
+
+// Bucket i holds calls that took less than 2^i microseconds, the last one the rest
+#define TOTAL_PROFILE_BUCKETS 16
+
+#ifdef WM_PROFILE
+
+typedef struct
+{
+    unsigned long calls;
+    long long total_us, max_us;
+    unsigned long requests;
+    unsigned long round_trips;
+    unsigned long histogram[TOTAL_PROFILE_BUCKETS];
+} profile_entry_t;
+
+typedef struct
+{
+    profile_entry_t entries[TOTAL_PROFILED];
+    // The handler that blocking calls should be attributed to
+    profile_handler_e current;
+} profiler_t;
+
+// Handlers nest (a key press might trigger a layout pass), time is inclusive
+typedef struct
+{
+    profile_handler_e handler, previous;
+    long long start;
+    unsigned long first_request;
+} profile_scope_t;
+
+profile_scope_t profile_begin(profiler_t *profiler, profile_handler_e handler,
+                              unsigned long next_request);
+void profile_end(profiler_t *profiler, const profile_scope_t *scope,
+                 unsigned long next_request);
+void profile_report(const profiler_t *profiler);
+// Maps X event types to their handlers
+profile_handler_e profile_handler_of_event(int type);
+
+// Runs `call`, attributing its time and requests to the given handler
+#define PROFILE_CALL(wm, handler, call) do { \
+        profile_scope_t _scope = \
+            profile_begin(&(wm)->profiler, (handler), NextRequest((wm)->conn)); \
+        call; \
+        profile_end(&(wm)->profiler, &_scope, NextRequest((wm)->conn)); \
+    } while (0)
+// Should be placed right before every call that waits on a reply
+#define PROFILE_ROUND_TRIP(wm) \
+    ((wm)->profiler.entries[(wm)->profiler.current].round_trips++)
+#define PROFILE_REPORT(wm) profile_report(&(wm)->profiler)
+
+#else
+
+#define PROFILE_CALL(wm, handler, call) call
+#define PROFILE_ROUND_TRIP(wm) ((void) 0)
+#define PROFILE_REPORT(wm) ((void) 0)
+
+#endif
+
+#endif
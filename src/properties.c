@@ -0,0 +1,332 @@
+#include "properties.h"
+#include "utils.h"
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+// The longest WM_PROTOCOLS list that we're willing to look through
+#define MAX_PROTOCOLS 16
+
+void properties_connect(property_queue_t *queue)
+{
+    // Both connections talk to the same server, so atoms and window IDs
+    // obtained through Xlib are perfectly valid over here as well
+    queue->conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(queue->conn))
+        log_fatal("failed to open property connection to X server");
+
+    // Spawned programs should never inherit it, check out wm_spawn()
+    fcntl(xcb_get_file_descriptor(queue->conn), F_SETFD, FD_CLOEXEC);
+
+    queue->total_pending = 0;
+}
+
+void properties_disconnect(property_queue_t *queue)
+{
+    xcb_disconnect(queue->conn);
+}
+
+static xcb_get_property_cookie_t get_property(property_queue_t *queue, Window w,
+                                              Atom prop, Atom type, uint32_t length)
+{
+    // Lengths are measured in 32-bit units, we never need more than a handful
+    return xcb_get_property(queue->conn, false, w, prop, type, 0, length);
+}
+
+static void send_query(property_queue_t *queue, client_t *client, bool is_new,
+                       int workspace, unsigned int properties)
+{
+    property_query_t *query = &queue->pending[queue->total_pending++];
+    Window w = client->window;
+
+    query->client = client;
+    query->is_new = is_new;
+    query->workspace = workspace;
+    query->properties = properties;
+    query->requested_at = monotonic_time_us();
+
+    // WM_SIZE_HINTS holds 18 values, the min and max dimensions are found within the first 9
+    if (properties & PROPERTY_NORMAL_HINTS)
+        query->normal_hints = get_property(queue, w, XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 18);
+    if (properties & PROPERTY_WINDOW_TYPE)
+        query->window_type = get_property(queue, w, queue->window_type_atom, XA_ATOM, 1);
+    if (properties & PROPERTY_TRANSIENT_FOR)
+        query->transient_for = get_property(queue, w, XA_WM_TRANSIENT_FOR, XA_WINDOW, 1);
+    if (properties & PROPERTY_PROTOCOLS)
+        query->protocols = get_property(queue, w, queue->protocols_atom, XA_ATOM, MAX_PROTOCOLS);
+    if (properties & PROPERTY_GEOMETRY)
+        query->geometry = xcb_get_geometry(queue->conn, w);
+    // Either STRING or COMPOUND_TEXT, both are fine for plain ASCII titles
+    if (properties & PROPERTY_TITLE)
+        query->title = get_property(queue, w, XA_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY,
+                MAX_TITLE_LENGTH / 4);
+    if (properties & PROPERTY_SYNC_COUNTER)
+        query->sync_counter = get_property(queue, w, queue->sync_counter_atom, XA_CARDINAL, 1);
+
+    // Get the requests on their way, the replies can be picked up whenever
+    xcb_flush(queue->conn);
+}
+
+void properties_request(property_queue_t *queue, client_t *client, int workspace)
+{
+    send_query(queue, client, true, workspace, PROPERTY_ALL);
+}
+
+void properties_refresh(property_queue_t *queue, client_t *client, unsigned int properties)
+{
+    // A client will often touch the same property several times in a row
+    for (int i = 0; i < queue->total_pending; i++)
+    {
+        property_query_t *query = &queue->pending[i];
+
+        if (query->client == client && !query->is_new &&
+            (query->properties & properties) == properties)
+        {
+            return;
+        }
+    }
+
+    send_query(queue, client, false, -1, properties);
+}
+
+static void discard_query(property_queue_t *queue, property_query_t *query)
+{
+    if (query->properties & PROPERTY_NORMAL_HINTS)
+        xcb_discard_reply(queue->conn, query->normal_hints.sequence);
+    if (query->properties & PROPERTY_WINDOW_TYPE)
+        xcb_discard_reply(queue->conn, query->window_type.sequence);
+    if (query->properties & PROPERTY_TRANSIENT_FOR)
+        xcb_discard_reply(queue->conn, query->transient_for.sequence);
+    if (query->properties & PROPERTY_PROTOCOLS)
+        xcb_discard_reply(queue->conn, query->protocols.sequence);
+    if (query->properties & PROPERTY_GEOMETRY)
+        xcb_discard_reply(queue->conn, query->geometry.sequence);
+    if (query->properties & PROPERTY_TITLE)
+        xcb_discard_reply(queue->conn, query->title.sequence);
+    if (query->properties & PROPERTY_SYNC_COUNTER)
+        xcb_discard_reply(queue->conn, query->sync_counter.sequence);
+}
+
+bool properties_cancel(property_queue_t *queue, client_t *client)
+{
+    int total = 0;
+
+    // Drop every query of the client, while preserving the order of the rest
+    for (int i = 0; i < queue->total_pending; i++)
+    {
+        if (queue->pending[i].client == client)
+            discard_query(queue, &queue->pending[i]);
+        else
+            queue->pending[total++] = queue->pending[i];
+    }
+
+    bool was_pending = (total != queue->total_pending);
+    queue->total_pending = total;
+
+    return was_pending;
+}
+
+client_t* properties_find_pending(property_queue_t *queue, Window window)
+{
+    for (int i = 0; i < queue->total_pending; i++)
+        if (queue->pending[i].is_new && queue->pending[i].client->window == window)
+            return queue->pending[i].client;
+
+    return NULL;
+}
+
+// Returns NULL if the property does not exist or the window is already gone
+static xcb_get_property_reply_t* get_reply(property_queue_t *queue,
+                                           xcb_get_property_cookie_t cookie)
+{
+    xcb_generic_error_t *error = NULL;
+    xcb_get_property_reply_t *reply = xcb_get_property_reply(queue->conn, cookie, &error);
+
+    free(error);
+    // X11 will indicate that the property does not exist by setting the type to None
+    if (reply && reply->type == XCB_NONE)
+    {
+        free(reply);
+        return NULL;
+    }
+
+    return reply;
+}
+
+static void store_size_hints(client_t *c, xcb_get_property_reply_t *reply)
+{
+    const uint32_t *hints = xcb_get_property_value(reply);
+    // Flags, x, y, width, height, min width, min height, max width, max height
+    if (xcb_get_property_value_length(reply) < 9 * sizeof(uint32_t))
+        return;
+
+    if (hints[0] & PMinSize)
+    {
+        c->min_width = hints[5];
+        c->min_height = hints[6];
+    }
+    if (hints[0] & PMaxSize)
+    {
+        c->max_width = hints[7];
+        c->max_height = hints[8];
+    }
+}
+
+static void store_protocols(property_queue_t *queue, client_t *c,
+                            xcb_get_property_reply_t *reply)
+{
+    const xcb_atom_t *atoms = xcb_get_property_value(reply);
+    const int total = xcb_get_property_value_length(reply) / sizeof(xcb_atom_t);
+
+    for (int i = 0; i < total; i++)
+        for (int p = 0; p < TOTAL_PROTOCOLS; p++)
+            if (atoms[i] == queue->protocol_atoms[p])
+                c->protocols |= (1 << p);
+}
+
+static void store_replies(property_queue_t *queue, property_query_t *query)
+{
+    xcb_get_property_reply_t *reply;
+    client_t *c = query->client;
+
+    // Only the very first reply will actually block, the rest have arrived by then
+    if (query->properties & PROPERTY_NORMAL_HINTS)
+    {
+        // The client might have dropped its hints altogether
+        c->min_width = c->max_width = -1;
+        c->min_height = c->max_height = -1;
+
+        if ((reply = get_reply(queue, query->normal_hints)))
+        {
+            store_size_hints(c, reply);
+            free(reply);
+        }
+    }
+
+    if (query->properties & PROPERTY_WINDOW_TYPE)
+    {
+        c->window_type = None;
+
+        if ((reply = get_reply(queue, query->window_type)))
+        {
+            if (xcb_get_property_value_length(reply) >= sizeof(xcb_atom_t))
+                c->window_type = *(xcb_atom_t*) xcb_get_property_value(reply);
+            free(reply);
+        }
+    }
+
+    if (query->properties & PROPERTY_TRANSIENT_FOR)
+    {
+        if ((reply = get_reply(queue, query->transient_for)))
+            free(reply);
+
+        c->is_transient = (reply != NULL);
+    }
+
+    if (query->properties & PROPERTY_PROTOCOLS)
+    {
+        c->protocols = 0;
+
+        if ((reply = get_reply(queue, query->protocols)))
+        {
+            store_protocols(queue, c, reply);
+            free(reply);
+        }
+    }
+
+    if (query->properties & PROPERTY_GEOMETRY)
+    {
+        xcb_get_geometry_reply_t *geometry =
+            xcb_get_geometry_reply(queue->conn, query->geometry, NULL);
+
+        // This is where the client asked to be placed, which is still
+        // respected for floating windows
+        if (geometry)
+        {
+            c->x = geometry->x, c->y = geometry->y;
+            c->width = geometry->width, c->height = geometry->height;
+            free(geometry);
+        }
+    }
+
+    if (query->properties & PROPERTY_TITLE)
+    {
+        c->title[0] = '\0';
+
+        if ((reply = get_reply(queue, query->title)))
+        {
+            const int length = MIN(xcb_get_property_value_length(reply), MAX_TITLE_LENGTH - 1);
+            memcpy(c->title, xcb_get_property_value(reply), length);
+            c->title[length] = '\0';
+            free(reply);
+        }
+    }
+
+    if (query->properties & PROPERTY_SYNC_COUNTER)
+    {
+        c->sync_counter = None;
+
+        if ((reply = get_reply(queue, query->sync_counter)))
+        {
+            if (xcb_get_property_value_length(reply) >= sizeof(uint32_t))
+                c->sync_counter = *(uint32_t*) xcb_get_property_value(reply);
+            free(reply);
+        }
+    }
+}
+
+int properties_find_mapped_children(property_queue_t *queue, Window parent, Window **windows)
+{
+    xcb_query_tree_reply_t *tree =
+        xcb_query_tree_reply(queue->conn, xcb_query_tree(queue->conn, parent), NULL);
+    if (!tree)
+        return -1;
+
+    const int total = xcb_query_tree_children_length(tree);
+    const xcb_window_t *children = xcb_query_tree_children(tree);
+
+    xcb_get_window_attributes_cookie_t *cookies = malloc(total * sizeof(*cookies));
+    *windows = malloc(total * sizeof(Window));
+    if ((total && !cookies) || (total && !*windows))
+        log_fatal("failed to allocate memory for existing windows");
+
+    // Every request goes out before the first reply is waited on
+    for (int i = 0; i < total; i++)
+        cookies[i] = xcb_get_window_attributes(queue->conn, children[i]);
+
+    int found = 0;
+    for (int i = 0; i < total; i++)
+    {
+        xcb_get_window_attributes_reply_t *attributes =
+            xcb_get_window_attributes_reply(queue->conn, cookies[i], NULL);
+
+        // Menus and our own containers are override-redirect, they're not ours to manage
+        // Children of an unmapped container are mapped, but not viewable
+        if (attributes && !attributes->override_redirect &&
+            attributes->map_state != XCB_MAP_STATE_UNMAPPED)
+        {
+            (*windows)[found++] = children[i];
+        }
+
+        free(attributes);
+    }
+
+    free(cookies);
+    free(tree);
+    return found;
+}
+
+int properties_collect(property_queue_t *queue, property_query_t *ready)
+{
+    for (int i = 0; i < queue->total_pending; i++)
+    {
+        store_replies(queue, &queue->pending[i]);
+        ready[i] = queue->pending[i];
+    }
+
+    int total = queue->total_pending;
+    queue->total_pending = 0;
+    return total;
+}
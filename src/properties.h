@@ -0,0 +1,99 @@
+#ifndef _WM_PROPERTIES_H
+#define _WM_PROPERTIES_H
+
+#include <stdbool.h>
+#include <xcb/xcb.h>
+#include "clients.h"
+
+/*
+ * Xlib only offers blocking property getters, each of them costing a full
+ * round trip to the server. We keep a second, XCB-based connection around
+ * that is solely used for reading client properties: requests are sent right
+ * away and their replies are collected later on through cookies. A burst of
+ * newly mapped windows will then only need to wait on the server once.
+ */
+#define MAX_PENDING_QUERIES 256
+
+// Selects which of the cached client properties a query should fetch
+typedef enum
+{
+    PROPERTY_NORMAL_HINTS = 1 << 0,
+    PROPERTY_WINDOW_TYPE = 1 << 1,
+    PROPERTY_TRANSIENT_FOR = 1 << 2,
+    PROPERTY_PROTOCOLS = 1 << 3,
+    // Not really a property, but it's needed right before the window is mapped
+    PROPERTY_GEOMETRY = 1 << 4,
+    PROPERTY_TITLE = 1 << 5,
+    PROPERTY_SYNC_COUNTER = 1 << 6,
+    PROPERTY_ALL = (1 << 7) - 1,
+} property_e;
+
+typedef struct
+{
+    client_t *client;
+    // Set for windows that have just asked to be mapped, not yet adopted
+    bool is_new;
+    // The workspace that was active when the window asked to be mapped
+    int workspace;
+    unsigned int properties;
+    // Timestamp of the query, see monotonic_time_us()
+    long long requested_at;
+
+    xcb_get_property_cookie_t normal_hints;
+    xcb_get_property_cookie_t window_type;
+    xcb_get_property_cookie_t transient_for;
+    xcb_get_property_cookie_t protocols;
+    xcb_get_geometry_cookie_t geometry;
+    xcb_get_property_cookie_t title;
+    xcb_get_property_cookie_t sync_counter;
+} property_query_t;
+
+typedef struct
+{
+    xcb_connection_t *conn;
+
+    // Non-predefined atoms, as interned by the window manager
+    Atom window_type_atom;
+    Atom protocols_atom;
+    Atom sync_counter_atom;
+    // WM_PROTOCOLS entries that we care about, indexed by their client_protocol_e bit
+    Atom protocol_atoms[TOTAL_PROTOCOLS];
+
+    property_query_t pending[MAX_PENDING_QUERIES];
+    int total_pending;
+} property_queue_t;
+
+void properties_connect(property_queue_t *queue);
+void properties_disconnect(property_queue_t *queue);
+
+// Sends out all queries for a brand new client without waiting for any reply
+void properties_request(property_queue_t *queue, client_t *client, int workspace);
+// Re-fetches the given properties of a client, after the client modified them
+void properties_refresh(property_queue_t *queue, client_t *client, unsigned int properties);
+
+// Forgets about a client whose window went away, discarding its queries
+// Returns false if the client was not waiting on any replies
+bool properties_cancel(property_queue_t *queue, client_t *client);
+// Only considers new clients. Returns NULL upon search failure
+client_t* properties_find_pending(property_queue_t *queue, Window window);
+
+/*
+ * Lists the mapped, non override-redirect children of a window. A single
+ * round trip covers the tree along with the attributes of every child.
+ * Returns -1 if the parent does not exist, otherwise the list must be freed
+ */
+int properties_find_mapped_children(property_queue_t *queue, Window parent, Window **windows);
+
+static inline bool properties_is_full(const property_queue_t *queue)
+{
+    return queue->total_pending == MAX_PENDING_QUERIES;
+}
+
+/*
+ * Waits for all outstanding replies and stores them inside their clients.
+ * The resolved queries are copied into `ready`, which must be able to hold
+ * MAX_PENDING_QUERIES items, and the queue is then emptied.
+ */
+int properties_collect(property_queue_t *queue, property_query_t *ready);
+
+#endif
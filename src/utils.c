@@ -2,17 +2,39 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <time.h>
 
-void log_fatal(const char *format, ...)
+static void log_message(const char *format, va_list args)
 {
-    va_list args;
-    va_start(args, format);
-
     // Just print out the supplied message with an informative prefix
     fprintf(stderr, "{TestWM error}: ");
     vfprintf(stderr, format, args);
     fprintf(stderr, "\n");
-    
+}
+
+void log_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    log_message(format, args);
     va_end(args);
+}
+
+void log_fatal(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    log_message(format, args);
+    va_end(args);
+
     exit(EXIT_FAILURE);
 }
+
+long long monotonic_time_us(void)
+{
+    struct timespec now;
+    // Unlike the wall clock, the monotonic clock never jumps backwards
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
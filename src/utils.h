@@ -6,6 +6,11 @@
 
 #define ARRAY_LEN(a) (sizeof(a) / sizeof(a[0]))
 
+// Microseconds elapsed since some arbitrary, fixed point in the past
+long long monotonic_time_us(void);
+
+// Prints out an error message, for failures that we can live with
+void log_error(const char *format, ...);
 // Prints out an error message and panics
 void log_fatal(const char *format, ...);
 
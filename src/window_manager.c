@@ -2,46 +2,218 @@
 #include "utils.h"
 #include "clients.h"
 #include "config.h"
-#include <X11/XKBlib.h>
 #include <X11/Xatom.h>
 #include <X11/cursorfont.h>
-
+#include <X11/extensions/sync.h>
+#ifdef WM_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
 #include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <assert.h>
 
-bool are_keys_equal(wm_key_t a, wm_key_t b)
+// The environment of spawned programs is the same as ours
+extern char **environ;
+
+// Must follow the order of wm_atom_e
+static const char *atom_names[TOTAL_ATOMS] = {
+    "WM_PROTOCOLS",
+    "WM_DELETE_WINDOW",
+    "WM_TAKE_FOCUS",
+    "_NET_ACTIVE_WINDOW",
+    "_NET_WM_WINDOW_TYPE",
+    "_NET_WM_WINDOW_TYPE_DIALOG",
+    "_NET_SUPPORTING_WM_CHECK",
+    "_NET_WM_NAME",
+    "UTF8_STRING",
+    "_NET_SUPPORTED",
+    "_NET_CLIENT_LIST",
+    "_NET_NUMBER_OF_DESKTOPS",
+    "_NET_CURRENT_DESKTOP",
+    "_NET_WM_DESKTOP",
+    "_NET_WM_SYNC_REQUEST",
+    "_NET_WM_SYNC_REQUEST_COUNTER",
+    "_WM_RESTART_STATE",
+};
+
+static inline monitor_t* get_monitor(wm_t *wm)
+{
+    return &wm->monitors[wm->active_monitor];
+}
+
+static inline workspace_t* workspace_on(wm_t *wm, int monitor, int index)
 {
-    return a.keysym == b.keysym && a.modifiers == b.modifiers;
+    return &wm->workspaces[monitor * TOTAL_WORKSPACES + index];
+}
+
+// The workspace that is currently shown on the given monitor
+static inline workspace_t* visible_workspace(wm_t *wm, int monitor)
+{
+    return workspace_on(wm, monitor, wm->monitors[monitor].active_workspace);
 }
 
 // Inlining this is definitely useless, I just want to be sure
 static inline workspace_t* get_workspace(wm_t *wm)
 {
-    return &wm->workspaces[wm->active_workspace];
+    return visible_workspace(wm, wm->active_monitor);
+}
+
+// Workspaces of all monitors that are currently plugged in
+static inline int total_workspaces(const wm_t *wm)
+{
+    return wm->total_monitors * TOTAL_WORKSPACES;
+}
+
+// Every inserted client belongs to the list of exactly one workspace
+static inline workspace_t* workspace_of(client_t *c)
+{
+    return (workspace_t*) ((char*) c->list - offsetof(workspace_t, clients));
+}
+
+// Returns NULL if the window is not managed by us or lives on a hidden workspace
+static client_t* find_visible_client(wm_t *wm, Window window)
+{
+    client_t *c = clients_find_by_window(&wm->index, window);
+    return (c && workspace_of(c) == visible_workspace(wm, workspace_of(c)->monitor)) ? c : NULL;
 }
 
-static wm_key_t key_event_to_key(wm_t *wm, const XKeyEvent *event)
+// Accounts for an operation that started at `start`, with `first_request` being NextRequest() back then
+static void record_latency(wm_t *wm, wm_latency_t *latency, long long start,
+                           unsigned long first_request)
 {
-    // XKeycodeToKeysym is deprecated, we need to use this instead
-    KeySym keysym = XkbKeycodeToKeysym(wm->conn, event->keycode, 0, 0);
+    const long long elapsed = monotonic_time_us() - start;
 
-    wm_key_t key = {
-        .keysym = keysym,
-        .modifiers = event->state,
+    latency->count++;
+    latency->total_us += elapsed;
+    latency->max_us = MAX(latency->max_us, elapsed);
+    latency->requests += NextRequest(wm->conn) - first_request;
+}
+
+// Points the timerfd to the earliest deadline, or disarms it if there is none
+static void update_timer_fd(wm_t *wm)
+{
+    long long earliest = 0;
+    for (int i = 0; i < TOTAL_TIMERS; i++)
+        if (wm->timers[i] && (!earliest || wm->timers[i] < earliest))
+            earliest = wm->timers[i];
+
+    // Deadlines are absolute, and an all-zero value disarms the timer
+    struct itimerspec spec = {
+        .it_value = {
+            .tv_sec = earliest / 1000000,
+            .tv_nsec = (earliest % 1000000) * 1000,
+        },
     };
 
-    return key;
+    timerfd_settime(wm->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void arm_timer(wm_t *wm, wm_timer_e timer, long long deadline)
+{
+    if (wm->timers[timer] == deadline)
+        return;
+
+    wm->timers[timer] = deadline;
+    update_timer_fd(wm);
+}
+
+static void disarm_timer(wm_t *wm, wm_timer_e timer)
+{
+    if (!wm->timers[timer])
+        return;
+
+    wm->timers[timer] = 0;
+    update_timer_fd(wm);
+}
+
+// Strips NumLock and CapsLock, so that bindings keep working while they are on
+static unsigned int clean_modifiers(wm_t *wm, unsigned int state)
+{
+    return state & ~(wm->numlock_mask | LockMask) &
+        (ShiftMask | ControlMask | Mod1Mask | Mod2Mask | Mod3Mask | Mod4Mask | Mod5Mask);
+}
+
+static void update_numlock_mask(wm_t *wm)
+{
+    PROFILE_ROUND_TRIP(wm);
+    XModifierKeymap *map = XGetModifierMapping(wm->conn);
+    KeyCode numlock = XKeysymToKeycode(wm->conn, XK_Num_Lock);
+
+    // Each of the 8 modifiers is mapped to at most max_keypermod keycodes
+    wm->numlock_mask = 0;
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < map->max_keypermod; j++)
+            if (numlock && map->modifiermap[i * map->max_keypermod + j] == numlock)
+                wm->numlock_mask = (1 << i);
+
+    XFreeModifiermap(map);
 }
 
 // Notifies the server that the given window expects the given key binding
-static void grab_key(wm_t *wm, wm_key_t key, Window window)
+static void grab_key(wm_t *wm, const wm_key_entry_t *entry, Window window)
+{
+    // The server matches modifiers exactly, so every lock combination needs its own grab
+    const unsigned int locks[] = {
+        0, LockMask, wm->numlock_mask, wm->numlock_mask | LockMask
+    };
+
+    for (int i = 0; i < ARRAY_LEN(locks); i++)
+        XGrabKey(wm->conn, entry->keycode, entry->modifiers | locks[i],
+                window, False, GrabModeAsync, GrabModeAsync);
+}
+
+static inline wm_key_entry_t* kill_client_entry(wm_t *wm)
 {
-    XGrabKey(wm->conn,
-        XKeysymToKeycode(wm->conn, key.keysym),
-        key.modifiers, window, False, GrabModeAsync, GrabModeAsync);
+    return &wm->key_entries[ARRAY_LEN(wm_bindings)];
+}
+
+/*
+ * Resolves the keysyms of config.h to keycodes once, so that a key press can
+ * be matched against its bindings right away. Keys that share a keycode are
+ * chained in the order of config.h, where the first match wins.
+ */
+static void build_key_table(wm_t *wm)
+{
+    const int total = ARRAY_LEN(wm_bindings) + 1;
+
+    for (int i = 0; i < TOTAL_KEYCODES; i++)
+        wm->key_table[i] = NULL;
+
+    update_numlock_mask(wm);
+
+    for (int i = 0; i < total; i++)
+    {
+        wm_key_entry_t *entry = &wm->key_entries[i];
+        const wm_key_t key = (i < total - 1) ? wm_bindings[i].key : wm_kill_client_key;
+
+        entry->keycode = XKeysymToKeycode(wm->conn, key.keysym);
+        entry->modifiers = clean_modifiers(wm, key.modifiers);
+        entry->binding = (i < total - 1) ? i : -1;
+        entry->next = NULL;
+
+        // The keysym is not present on this keyboard
+        if (!entry->keycode)
+            continue;
+
+        wm_key_entry_t **link = &wm->key_table[entry->keycode];
+        while (*link)
+            link = &(*link)->next;
+
+        *link = entry;
+    }
 }
 
 // Temporary error handler used solely during the initialization phase
@@ -56,14 +228,90 @@ static int on_wm_error(Display *display, XErrorEvent *error)
     return 0;
 }
 
-// An error handler that will just ignore all failures
-static int dummy_error_handler(Display *display, XErrorEvent *error)
+/*
+ * Requests sent to windows that might have already destroyed themselves are
+ * allowed to fail. Instead of waiting on the server to find out, we remember
+ * the sequence numbers of these requests and silently drop their errors.
+ */
+#define MAX_IGNORED_RANGES 64
+
+typedef struct
 {
-    return 0;
+    unsigned long first, last;
+} serial_range_t;
+
+// The error handler is not given any user data, so this has to be global
+static serial_range_t ignored_ranges[MAX_IGNORED_RANGES];
+static int total_ignored_ranges = 0;
+
+// Ranges that the server has already gone past can not produce any more errors
+static void prune_ignored_ranges(Display *display)
+{
+    unsigned long processed = LastKnownRequestProcessed(display);
+    int total = 0;
+
+    for (int i = 0; i < total_ignored_ranges; i++)
+        if (ignored_ranges[i].last > processed)
+            ignored_ranges[total++] = ignored_ranges[i];
+
+    total_ignored_ranges = total;
+}
+
+// Returns the sequence number of the first request whose errors should be ignored
+static unsigned long begin_ignoring_errors(wm_t *wm)
+{
+    return NextRequest(wm->conn);
+}
+
+static void end_ignoring_errors(wm_t *wm, unsigned long first)
+{
+    unsigned long last = NextRequest(wm->conn) - 1;
+    if (last < first)
+        return;
+
+    /*
+     * Ranges are kept sorted and disjoint. Back to back ranges are really
+     * common, and so are nested ones: the inner range closes first, so the
+     * outer one covers it along with whatever came before it. Either way,
+     * every trailing range that overlaps or touches this one is merged into it
+     */
+    while (total_ignored_ranges > 0)
+    {
+        const serial_range_t *prev = &ignored_ranges[total_ignored_ranges - 1];
+        if (prev->last + 1 < first)
+            break;
+
+        first = MIN(prev->first, first);
+        last = MAX(prev->last, last);
+        total_ignored_ranges--;
+    }
+
+    prune_ignored_ranges(wm->conn);
+    if (total_ignored_ranges == MAX_IGNORED_RANGES)
+    {
+        // This should pretty much never happen. Let the server catch up
+        PROFILE_ROUND_TRIP(wm);
+        XSync(wm->conn, false);
+        prune_ignored_ranges(wm->conn);
+    }
+
+    ignored_ranges[total_ignored_ranges++] = (serial_range_t) { first, last };
+}
+
+static bool is_error_ignored(const XErrorEvent *error)
+{
+    for (int i = 0; i < total_ignored_ranges; i++)
+        if (error->serial >= ignored_ranges[i].first && error->serial <= ignored_ranges[i].last)
+            return true;
+
+    return false;
 }
 
 static int on_x_error(Display *display, XErrorEvent *error)
 {
+    if (is_error_ignored(error))
+        return 0;
+
     char error_message[1024];
     XGetErrorText(display, error->error_code, error_message, sizeof(error_message));
 
@@ -73,30 +321,24 @@ static int on_x_error(Display *display, XErrorEvent *error)
 
 static void create_bindings(wm_t *wm)
 {
+    // Drop any stale grabs, the keycodes might have changed since
+    XUngrabKey(wm->conn, AnyKey, AnyModifier, wm->root);
+
     // Iterate over all key bindings and register their presence
     for (int i = 0; i < ARRAY_LEN(wm_bindings); i++)
     {
-        wm_binding_t *binding = &wm_bindings[i];
-        grab_key(wm, binding->key, wm->root);
+        wm_key_entry_t *entry = &wm->key_entries[i];
+        if (entry->keycode)
+            grab_key(wm, entry, wm->root);
     }
 }
 
 // Will return false if the client does not participate in the protocol (README.md)
-static bool try_send_wm_protocol(wm_t *wm, Window window, Atom protocol)
+static bool try_send_wm_protocol(wm_t *wm, client_t *c, client_protocol_e protocol)
 {
-    bool is_supported = false;
-    Atom *protocols;
-    int total_protocols;
-
-    // Search the supported protocols list for a match
-    if (XGetWMProtocols(wm->conn, window, &protocols, &total_protocols))
-    {
-        for (int i = 0; i < total_protocols; i++)
-            if (is_supported = (protocols[i] == protocol))
-                break;
-
-        XFree(protocols);
-    }
+    // The list of supported protocols is cached, no need to ask the server
+    bool is_supported = c->protocols & (1 << protocol);
+    Window window = c->window;
 
     if (is_supported)
     {
@@ -112,7 +354,7 @@ static bool try_send_wm_protocol(wm_t *wm, Window window, Atom protocol)
             }
         };
 
-        event.xclient.data.l[0] = protocol;
+        event.xclient.data.l[0] = wm->properties.protocol_atoms[protocol];
         // CurrentTime is most likely used by the server to combat race conditions.
         // I couldn't find any reference to it in the manual, but everybody does it
         event.xclient.data.l[1] = CurrentTime;
@@ -122,32 +364,185 @@ static bool try_send_wm_protocol(wm_t *wm, Window window, Atom protocol)
     return is_supported;
 }
 
-// This function returns None if the specified property does not exist on the given window
-static Atom get_window_prop(wm_t *wm, Window w, Atom prop)
+static void set_window_prop(wm_t *wm, Window w, Atom a, Atom type,
+                            unsigned long *values, unsigned long total)
 {
-    Atom type, value;
-    unsigned char *data = NULL;
-    // These can all be ignored for now, we won't be needing them
-    int format;
-    unsigned long items, rem_bytes;
+    // Set the property, overriding the previous value if set
+    XChangeProperty(wm->conn, w, a, type, 32, PropModeReplace, (unsigned char*) values, total);
+}
+
+/*
+ * EWMH desktops are global, while our workspaces belong to monitors. Every
+ * workspace of every monitor is exposed as a desktop of its own, numbered by
+ * its index in wm->workspaces
+ */
+static void publish_current_desktop(wm_t *wm)
+{
+    unsigned long current = get_workspace(wm) - wm->workspaces;
+    set_window_prop(wm, wm->root, wm->atoms[ATOM_NET_CURRENT_DESKTOP], XA_CARDINAL, &current, 1);
+}
+
+static void publish_desktops(wm_t *wm)
+{
+    unsigned long total = total_workspaces(wm);
+    set_window_prop(wm, wm->root, wm->atoms[ATOM_NET_NUMBER_OF_DESKTOPS], XA_CARDINAL, &total, 1);
+    publish_current_desktop(wm);
+}
+
+// The window might already be gone, the caller should be ignoring errors
+static void publish_client_desktop(wm_t *wm, client_t *c)
+{
+    unsigned long desktop = workspace_of(c) - wm->workspaces;
+    set_window_prop(wm, c->window, wm->atoms[ATOM_NET_WM_DESKTOP], XA_CARDINAL, &desktop, 1);
+}
+
+/*
+ * New clients are appended to _NET_CLIENT_LIST as they are adopted, which
+ * only costs a request. Removing one means rewriting the whole list, which
+ * is deferred until the end of the batch so that closing several windows at
+ * once only rewrites it a single time
+ */
+static void append_client_list(wm_t *wm, Window *windows, int total)
+{
+    // The list is about to be rewritten as a whole anyway
+    if (total == 0 || wm->is_client_list_dirty)
+        return;
+
+    XChangeProperty(wm->conn, wm->root, wm->atoms[ATOM_NET_CLIENT_LIST], XA_WINDOW, 32,
+            PropModeAppend, (unsigned char*) windows, total);
+}
+
+static void flush_client_list(wm_t *wm)
+{
+    if (!wm->is_client_list_dirty)
+        return;
+
+    wm->is_client_list_dirty = false;
+
+    int total = 0;
+    for (int i = 0; i < total_workspaces(wm); i++)
+        total += wm->workspaces[i].clients.length;
+
+    Window *windows = malloc(MAX(total, 1) * sizeof(Window));
+    if (!windows)
+        log_fatal("failed to allocate memory for client list");
+
+    Window *w = windows;
+    for (int i = 0; i < total_workspaces(wm); i++)
+        for (client_t *c = wm->workspaces[i].clients.head; c; c = c->next)
+            *w++ = c->window;
+
+    set_window_prop(wm, wm->root, wm->atoms[ATOM_NET_CLIENT_LIST], XA_WINDOW, windows, total);
+    free(windows);
+}
+
+// Only called when the root window was renamed, which is rare enough for a round trip
+static void update_status(wm_t *wm)
+{
+    char *name = NULL;
+    memset(wm->status, 0, sizeof(wm->status));
 
-    if (XGetWindowProperty(wm->conn, w, prop, 0L, sizeof(Atom), false,
-            XA_ATOM, &type, &format, &items, &rem_bytes, &data) == Success && data)
+    PROFILE_ROUND_TRIP(wm);
+    if (XFetchName(wm->conn, wm->root, &name) && name)
     {
-        value = *(Atom*) data;
-        XFree(data);
+        strncpy(wm->status, name, sizeof(wm->status) - 1);
+        XFree(name);
     }
+}
+
+/*
+ * Hands every bar the state of its monitor. Bars only repaint what changed,
+ * so this costs nothing but a few comparisons when the batch left them alone
+ */
+static void update_bars(wm_t *wm)
+{
+    if (!wm->bar_height)
+        return;
 
-    // X11 will indicate that the property does not exist
-    // by filling in the type variable with the value of None
-    return type != None ? value : None;
+    for (int m = 0; m < wm->total_monitors; m++)
+    {
+        bar_state_t state;
+        memset(&state, 0, sizeof(state));
+
+        for (int i = 0; i < TOTAL_WORKSPACES; i++)
+            if (workspace_on(wm, m, i)->clients.length)
+                state.occupied |= 1 << i;
+
+        state.visible_workspace = wm->monitors[m].active_workspace;
+        state.is_active = (m == wm->active_monitor);
+
+        client_t *focused = clients_get_focused(&visible_workspace(wm, m)->clients);
+        if (focused)
+            strncpy(state.title, focused->title, sizeof(state.title) - 1);
+
+        memcpy(state.status, wm->status, sizeof(state.status));
+        bar_update(&wm->bars[m], &state);
+    }
 }
 
-static void set_window_prop(wm_t *wm, Window w, Atom a, Atom type,
-                            unsigned long *values, unsigned long total)
+// Keeps a bar on top of every monitor, matching its position and width
+static void place_bars(wm_t *wm)
 {
-    // Set the property, overriding the previous value if set
-    XChangeProperty(wm->conn, w, a, type, 32, PropModeReplace, (unsigned char*) values, total);
+    if (!wm->bar_height)
+        return;
+
+    for (int m = 0; m < MAX_MONITORS; m++)
+    {
+        bar_t *bar = &wm->bars[m];
+        const monitor_t *monitor = &wm->monitors[m];
+
+        if (m < wm->total_monitors && bar_is_open(bar) && bar->x == monitor->x &&
+            bar->y == monitor->y && bar->width == monitor->width)
+        {
+            continue;
+        }
+
+        // The image is sized to the bar, so resizing means starting over
+        bar_close(bar);
+        if (m < wm->total_monitors)
+            bar_open(bar, wm->conn, &wm->bar_theme, monitor->x, monitor->y, monitor->width);
+    }
+}
+
+// Whatever we publish, so that clients know which hints they can rely on
+static void publish_supported(wm_t *wm)
+{
+    static const wm_atom_e supported[] = {
+        ATOM_NET_ACTIVE_WINDOW, ATOM_WM_WINDOW_TYPE, ATOM_WM_DIALOG_TYPE,
+        ATOM_NET_SUPPORTING_WM_CHECK, ATOM_NET_WM_NAME,
+        ATOM_NET_SUPPORTED, ATOM_NET_CLIENT_LIST, ATOM_NET_NUMBER_OF_DESKTOPS,
+        ATOM_NET_CURRENT_DESKTOP, ATOM_NET_WM_DESKTOP, ATOM_NET_WM_SYNC_REQUEST,
+        ATOM_NET_WM_SYNC_REQUEST_COUNTER,
+    };
+
+    Atom atoms[ARRAY_LEN(supported)];
+    for (int i = 0; i < ARRAY_LEN(supported); i++)
+        atoms[i] = wm->atoms[supported[i]];
+
+    set_window_prop(wm, wm->root, wm->atoms[ATOM_NET_SUPPORTED], XA_ATOM, atoms, ARRAY_LEN(atoms));
+}
+
+/*
+ * Pagers and panels only trust the rest of our root properties once they
+ * find a child window that points back to itself through
+ * _NET_SUPPORTING_WM_CHECK. A stale property left by a WM that died would
+ * point to a window that no longer exists. The window is never mapped
+ */
+static void publish_wm_check(wm_t *wm)
+{
+    XSetWindowAttributes attributes = { .override_redirect = true };
+    wm->check_window = XCreateWindow(wm->conn, wm->root, -1, -1, 1, 1, 0,
+            CopyFromParent, InputOnly, CopyFromParent, CWOverrideRedirect, &attributes);
+
+    unsigned long check = wm->check_window;
+    set_window_prop(wm, wm->check_window, wm->atoms[ATOM_NET_SUPPORTING_WM_CHECK],
+            XA_WINDOW, &check, 1);
+    set_window_prop(wm, wm->root, wm->atoms[ATOM_NET_SUPPORTING_WM_CHECK], XA_WINDOW, &check, 1);
+
+    static const char name[] = "TestWM";
+    XChangeProperty(wm->conn, wm->check_window, wm->atoms[ATOM_NET_WM_NAME],
+            wm->atoms[ATOM_UTF8_STRING], 8, PropModeReplace,
+            (const unsigned char*) name, sizeof(name) - 1);
 }
 
 static bool should_client_float(wm_t *wm, client_t *c)
@@ -160,28 +555,54 @@ static bool should_client_float(wm_t *wm, client_t *c)
         return true;
     }
 
-    Atom type = get_window_prop(wm, c->window, wm->atoms[ATOM_WM_WINDOW_TYPE]);
-
     // _NET_WM_WINDOW_TYPE_DIALOG indicates that this is a dialog window.
-    if (type == wm->atoms[ATOM_WM_DIALOG_TYPE])
+    if (c->window_type == wm->atoms[ATOM_WM_DIALOG_TYPE])
         return true;
 
-    else if (type == None)
-    {
-        // Quoting from freedesktop.org: If _NET_WM_WINDOW_TYPE is not set,
-        // then managed windows with WM_TRANSIENT_FOR set MUST be taken as this type.
-        Window trans = None;
-        if (XGetTransientForHint(wm->conn, c->window, &trans))
-            return true;
-    }
+    // Quoting from freedesktop.org: If _NET_WM_WINDOW_TYPE is not set,
+    // then managed windows with WM_TRANSIENT_FOR set MUST be taken as this type.
+    return c->window_type == None && c->is_transient;
+}
 
-    return false;
+// The focus of the active workspace will be committed at the end of the current batch
+static inline void mark_focus_dirty(wm_t *wm)
+{
+    wm->is_focus_dirty = true;
 }
 
-static void visually_reflect_focus(wm_t *wm, workspace_t *space)
+/*
+ * Focus changes only ever touch the focus stacks, the server is told about
+ * the outcome once per batch. Holding down a focus binding (or sweeping the
+ * cursor across several windows) then only costs the requests of the final
+ * target, and the windows in between never see FocusIn and FocusOut.
+ */
+static void flush_focus(wm_t *wm)
 {
+    if (!wm->is_focus_dirty)
+        return;
+
+    wm->is_focus_dirty = false;
+    workspace_t *space = get_workspace(wm);
     client_t *c = clients_get_focused(&space->clients);
 
+    // The batch went around in a circle
+    if (c == wm->committed_focus && !wm->is_focus_lost)
+        return;
+
+    const long long start = monotonic_time_us();
+    const unsigned long first_request = NextRequest(wm->conn);
+    // The previous one might have been destroyed in the meantime
+    unsigned long first_ignored = begin_ignoring_errors(wm);
+
+    ipc_broadcast(&wm->ipc, "event focus 0x%lx\n", c ? c->window : None);
+
+    // Only the committed client ever has its border highlighted
+    if (wm->committed_focus && wm->committed_focus != c)
+        XSetWindowBorder(wm->conn, wm->committed_focus->window, wm->border_color.pixel);
+
+    wm->committed_focus = c;
+    wm->is_focus_lost = false;
+
     if (!c)
     {
         XSetInputFocus(wm->conn, wm->root, RevertToPointerRoot, CurrentTime);
@@ -191,21 +612,18 @@ static void visually_reflect_focus(wm_t *wm, workspace_t *space)
     else
     {
         XSetWindowBorder(wm->conn, c->window, wm->focused_border_color.pixel);
+        // All tiled windows overlap, only the one on top is visible
+        if (space->layout == LAYOUT_MONOCLE && !c->is_floating)
+            XRaiseWindow(wm->conn, c->window);
 
         set_window_prop(wm, wm->root, wm->atoms[ATOM_NET_ACTIVE_WINDOW], XA_WINDOW, &c->window, 1);
         // The server will generate FocusIn and FocusOut events
         XSetInputFocus(wm->conn, c->window, RevertToPointerRoot, CurrentTime);
-        try_send_wm_protocol(wm, c->window, wm->atoms[ATOM_WM_TAKE_FOCUS]);
+        try_send_wm_protocol(wm, c, PROTOCOL_TAKE_FOCUS);
     }
-}
 
-// Sounds like a magic trick
-static void visually_unfocus_focused(wm_t *wm, workspace_t *space)
-{
-    client_t *c = clients_get_focused(&space->clients);
-
-    if (c)
-        XSetWindowBorder(wm->conn, c->window, wm->border_color.pixel);
+    end_ignoring_errors(wm, first_ignored);
+    record_latency(wm, &wm->stats.focus_latency, start, first_request);
 }
 
 static void focus_client(wm_t *wm, workspace_t *space, client_t *c)
@@ -213,29 +631,122 @@ static void focus_client(wm_t *wm, workspace_t *space, client_t *c)
     client_t *cur = clients_get_focused(&space->clients);
     if (cur == c) return;
 
-    visually_unfocus_focused(wm, space);
     clients_push_focus(&space->clients, c);
-    visually_reflect_focus(wm, space);
+    wm->stats.focus_changes++;
+    mark_focus_dirty(wm);
 }
 
 static void try_load_named_color(wm_t *wm, const char *id, XColor *color)
 {
-    if (!XAllocNamedColor(wm->conn, wm->colormap, id, color, color))
-        log_fatal("failed to load focused border color");
+    if (wm->total_allocated_pixels == MAX_ALLOCATED_COLORS ||
+        !XAllocNamedColor(wm->conn, wm->colormap, id, color, color))
+    {
+        log_fatal("failed to load color %s", id);
+    }
+
+    wm->allocated_pixels[wm->total_allocated_pixels++] = color->pixel;
 }
 
-void wm_setup(wm_t *wm)
+/*
+ * Containers span their entire monitor, so client coordinates are relative to
+ * the monitor. ParentRelative makes them show the root background, as if they
+ * weren't even there.
+ */
+static Window create_container(wm_t *wm, const monitor_t *monitor)
+{
+    XSetWindowAttributes attributes = {
+        .background_pixmap = ParentRelative,
+        // Keep other clients (and pagers) from ever treating it as a top-level window
+        .override_redirect = true,
+        // Clients are now children of containers, this is where their requests end up
+        // Entering a container means that the pointer moved onto its monitor
+        .event_mask = SubstructureRedirectMask | SubstructureNotifyMask | EnterWindowMask,
+    };
+
+    return XCreateWindow(wm->conn, wm->root, monitor->x, monitor->y,
+            monitor->width, monitor->height, 0,
+            CopyFromParent, InputOutput, CopyFromParent,
+            CWBackPixmap | CWOverrideRedirect | CWEventMask, &attributes);
+}
+
+/*
+ * Signals are delivered through a file descriptor, so that the main loop can
+ * handle them in between X events. They have to be blocked for this to work.
+ */
+static void setup_signals(wm_t *wm)
 {
-    struct sigaction sa;
+    sigset_t mask;
+    sigemptyset(&mask);
+
+    // We're going to spawn launchers and terminals using key bindings, and
+    // their exit statuses have to be collected to prevent zombie processes
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+        log_fatal("failed to block signals");
+
+    wm->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (wm->signal_fd == -1)
+        log_fatal("failed to create signal file descriptor");
+}
+
+static void watch_fd(wm_t *wm, int fd)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+
+    if (epoll_ctl(wm->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        log_fatal("failed to watch file descriptor %d", fd);
+}
+
+static void setup_event_loop(wm_t *wm)
+{
+    wm->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wm->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (wm->epoll_fd == -1 || wm->timer_fd == -1)
+        log_fatal("failed to set up the event loop");
 
-    // Prevent the creation of child zombie processes
-    // This is important because we're going to spawn launchers and terminals
-    //  using window manager key bindings, and we certainly don't want to wait() on them
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_NOCLDSTOP | SA_NOCLDWAIT | SA_RESTART;
-    // SIG_IGN = ignore. Don't execute any code, just apply the flag side-effects
-    sa.sa_handler = SIG_IGN;
-    sigaction(SIGCHLD, &sa, NULL);
+    for (int i = 0; i < TOTAL_TIMERS; i++)
+        wm->timers[i] = 0;
+
+    watch_fd(wm, ConnectionNumber(wm->conn));
+    watch_fd(wm, wm->timer_fd);
+    watch_fd(wm, wm->signal_fd);
+
+    /*
+     * The socket can spawn programs, so it must never be reachable by other
+     * users. A shared directory such as /tmp would let them connect, or take
+     * the path before we do. One socket per display, so that nested servers
+     * (Xephyr) don't clash
+     */
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir || !*runtime_dir)
+    {
+        log_error("XDG_RUNTIME_DIR is not set, the IPC socket is disabled");
+        ipc_open(&wm->ipc, wm->epoll_fd, NULL);
+        unsetenv("TESTWM_SOCKET");
+        return;
+    }
+
+    char path[sizeof(wm->ipc.path)];
+    snprintf(path, sizeof(path), "%s/testwm%s.sock", runtime_dir, DisplayString(wm->conn));
+
+    ipc_open(&wm->ipc, wm->epoll_fd, path);
+    // Scripts that we spawn can find the socket through their environment
+    setenv("TESTWM_SOCKET", path, true);
+}
+
+// Defined along with the rest of the adoption logic
+static bool restore_state(wm_t *wm);
+static void update_monitors(wm_t *wm);
+static void adopt_existing_windows(wm_t *wm);
+
+void wm_setup(wm_t *wm)
+{
+    setup_signals(wm);
 
     // Connect to an X server
     // Use the $DISPLAY environment variable as a default
@@ -243,11 +754,28 @@ void wm_setup(wm_t *wm)
     if (!wm->conn)
         log_fatal("failed to connect to X server: %s", XDisplayName(NULL));
 
+    // Spawned programs should never get their hands on our connection
+    fcntl(ConnectionNumber(wm->conn), F_SETFD, FD_CLOEXEC);
+
     // An initial root window will always be present
     wm->root = DefaultRootWindow(wm->conn);
     wm->is_running = true;
+    wm->is_restarting = false;
+    // The WM lives on the stack of main(), so counters start out as garbage
+    memset(&wm->stats, 0, sizeof(wm->stats));
     wm->dragged_client = NULL;
+    wm->has_pending_drag = false;
+    wm->last_drag_commit = 0;
     wm->gap = WM_INITIAL_GAP;
+    // A previous instance might have left a stale list behind
+    wm->is_client_list_dirty = true;
+    wm->committed_focus = NULL;
+    wm->is_focus_dirty = false;
+    wm->is_focus_lost = false;
+
+#ifdef WM_PROFILE
+    memset(&wm->profiler, 0, sizeof(wm->profiler));
+#endif
 
     /*
      * Checking whether we've got a right for Substructure Redirection
@@ -255,7 +783,9 @@ void wm_setup(wm_t *wm)
      */
     XSetErrorHandler(on_wm_error);
     // For substructure redirection, check out page 361 of the programming manual!
-    XSelectInput(wm->conn, wm->root, PointerMotionMask | SubstructureRedirectMask | SubstructureNotifyMask);
+    // The bar shows the name of the root window, so changes have to be caught
+    XSelectInput(wm->conn, wm->root, PointerMotionMask | SubstructureRedirectMask |
+            SubstructureNotifyMask | (WM_SHOW_BAR ? PropertyChangeMask : NoEventMask));
     // Wait until all pending requests have been fully processed by the X server.
     // the second argument must always be false, since we don't want to discard incoming queue events
     XSync(wm->conn, false);
@@ -263,137 +793,399 @@ void wm_setup(wm_t *wm)
     XSetErrorHandler(on_x_error);
 
     // Setting the cursor for our root window. The default is a big X
-    Cursor cursor = XCreateFontCursor(wm->conn, XC_left_ptr);
-    XDefineCursor(wm->conn, wm->root, cursor);
-
-    wm->atoms[ATOM_WM_PROTOCOLS] = XInternAtom(wm->conn, "WM_PROTOCOLS", false);
-    wm->atoms[ATOM_WM_DELETE_WINDOW] = XInternAtom(wm->conn, "WM_DELETE_WINDOW", false);
-    wm->atoms[ATOM_NET_ACTIVE_WINDOW] = XInternAtom(wm->conn, "_NET_ACTIVE_WINDOW", false);
-    wm->atoms[ATOM_WM_WINDOW_TYPE] = XInternAtom(wm->conn, "_NET_WM_WINDOW_TYPE", false);
-    wm->atoms[ATOM_WM_DIALOG_TYPE] = XInternAtom(wm->conn, "_NET_WM_WINDOW_TYPE_DIALOG", false);
+    wm->cursor = XCreateFontCursor(wm->conn, XC_left_ptr);
+    XDefineCursor(wm->conn, wm->root, wm->cursor);
+
+    // Intern all atoms at once, using a single round trip
+    if (!XInternAtoms(wm->conn, (char**) atom_names, TOTAL_ATOMS, false, wm->atoms))
+        log_fatal("failed to intern atoms");
+
+    publish_supported(wm);
+    publish_wm_check(wm);
+
+    wm->key_entries = malloc((ARRAY_LEN(wm_bindings) + 1) * sizeof(wm_key_entry_t));
+    if (!wm->key_entries)
+        log_fatal("failed to allocate memory for key bindings");
+
+    build_key_table(wm);
     create_bindings(wm);
 
     int screen = DefaultScreen(wm->conn);
-    wm->width = DisplayWidth(wm->conn, screen);
-    wm->height = DisplayHeight(wm->conn, screen);
 
-    for (int i = 0; i < TOTAL_WORKSPACES; i++)
-    {
-        wm->workspaces[i].special_width = wm->width / 2;
-        clients_initialize(&wm->workspaces[i].clients);
-    }
-    wm->active_workspace = 0;
+    // Monitors are only discovered once the restart state has been looked at
+    clients_index_initialize(&wm->index);
+    wm->total_monitors = 0;
+    wm->active_monitor = 0;
+
+#ifdef WM_XRANDR
+    // Notifies us whenever outputs are plugged in, unplugged or resized
+    int randr_error_base;
+    if (XRRQueryExtension(wm->conn, &wm->randr_event_base, &randr_error_base))
+        XRRSelectInput(wm->conn, wm->root, RRScreenChangeNotifyMask);
+    else
+        wm->randr_event_base = -1;
+#endif
 
     // Load in some colors
     wm->colormap = DefaultColormap(wm->conn, screen);
+    wm->total_allocated_pixels = 0;
 
     try_load_named_color(wm, "red", &wm->focused_border_color);
     try_load_named_color(wm, "black", &wm->border_color);
 
-    puts("WM was initialized successfully");
-}
+    // Bars are opened along with their monitors, check out place_bars()
+    wm->bar_height = 0;
+    for (int i = 0; i < MAX_MONITORS; i++)
+        wm->bars[i].window = None;
 
-static void get_size_hints(wm_t *wm, client_t *c)
-{
-    XSizeHints hints;
-    // We can ignore this value safely
-    long supplied_return;
+    XColor bar_foreground, bar_inactive;
+    try_load_named_color(wm, "gray80", &bar_foreground);
+    try_load_named_color(wm, "gray30", &bar_inactive);
 
-    if (XGetWMNormalHints(wm->conn, c->window, &hints, &supplied_return))
+    if (WM_SHOW_BAR && bar_load_theme(&wm->bar_theme, wm->conn, WM_BAR_FONT,
+            bar_foreground.pixel, wm->border_color.pixel,
+            wm->focused_border_color.pixel, bar_inactive.pixel))
     {
-        if (hints.flags & PMinSize)
-        {
-            c->min_width = hints.min_width;
-            c->min_height = hints.min_height;
-        }
-        if (hints.flags & PMaxSize)
-        {
-            c->max_width = hints.max_width;
-            c->max_height = hints.max_height;
-        }
+        wm->bar_height = wm->bar_theme.height;
+        update_status(wm);
     }
-}
 
-/*
- * Re-calculate all tiling positions in a single workspace
- * This should generally be called after ground-breaking layout changes
- */
-static void tile(wm_t *wm, workspace_t *space)
-{
-    // Setting to false to prevent EnterNotify events from firing because of
-    // the cursor now being above a brand new window.
-    wm->has_moved_cursor = false;
+    setup_event_loop(wm);
 
-    // Do not consider floating windows
-    int tiled_clients = 0;
-    for (client_t *c = space->clients.head; c; c = c->next)
-        tiled_clients += (!c->is_floating);
+    properties_connect(&wm->properties);
+    wm->properties.window_type_atom = wm->atoms[ATOM_WM_WINDOW_TYPE];
+    wm->properties.protocols_atom = wm->atoms[ATOM_WM_PROTOCOLS];
+    wm->properties.protocol_atoms[PROTOCOL_DELETE_WINDOW] = wm->atoms[ATOM_WM_DELETE_WINDOW];
+    wm->properties.protocol_atoms[PROTOCOL_TAKE_FOCUS] = wm->atoms[ATOM_WM_TAKE_FOCUS];
+    wm->properties.protocol_atoms[PROTOCOL_SYNC_REQUEST] = wm->atoms[ATOM_NET_WM_SYNC_REQUEST];
+    wm->properties.sync_counter_atom = wm->atoms[ATOM_NET_WM_SYNC_REQUEST_COUNTER];
 
-    if (tiled_clients == 0) return;
+    // Without it, resizes are simply sent as fast as they come
+    int sync_error_base, sync_major, sync_minor;
+    wm->has_sync = XSyncQueryExtension(wm->conn, &wm->sync_event_base, &sync_error_base) &&
+        XSyncInitialize(wm->conn, &sync_major, &sync_minor);
 
-    const int max_width = wm->width - 2 * wm->gap;
-    const int max_height = wm->height - 2 * wm->gap;
+    // A previous instance might have left its monitors and containers behind
+    // for us, which are then matched against the outputs that we actually have
+    const bool is_restored = restore_state(wm);
+    update_monitors(wm);
 
-    // Find the first non-floating window
-    client_t *special = space->clients.head;
-    while (special->is_floating) special = special->next;
+    if (is_restored)
+        mark_focus_dirty(wm);
 
-    if (tiled_clients == 1)
-    {
-        XMoveResizeWindow(wm->conn, special->window, wm->gap, wm->gap, max_width, max_height);
-    }
-    else
+    // Restored clients are all listed at once, adopted ones are then appended
+    flush_client_list(wm);
+    adopt_existing_windows(wm);
+    flush_focus(wm);
+    XFlush(wm->conn);
+
+    puts("WM was initialized successfully");
+}
+
+static inline XSyncValue to_sync_value(long long value)
+{
+    XSyncValue result;
+    XSyncIntsToValue(&result, value & 0xffffffff, value >> 32);
+    return result;
+}
+
+static inline long long from_sync_value(XSyncValue value)
+{
+    return ((long long) XSyncValueHigh32(value) << 32) | XSyncValueLow32(value);
+}
+
+static inline bool can_sync(const wm_t *wm, const client_t *c)
+{
+    return wm->has_sync && c->sync_alarm != None && (c->protocols & (1 << PROTOCOL_SYNC_REQUEST));
+}
+
+/*
+ * _NET_WM_SYNC_REQUEST: right before a resize, the client is sent a value,
+ * which it stores into its counter once it's done repainting for the new
+ * size. Our alarm on the counter lets us know when that happened, without
+ * ever having to poll it.
+ */
+static void start_syncing(wm_t *wm, client_t *c)
+{
+    if (!wm->has_sync || c->sync_counter == None)
+        return;
+
+    // Starting from a known value, whatever the client left in there
+    c->sync_value = 0;
+    unsigned long first_request = begin_ignoring_errors(wm);
+    XSyncSetCounter(wm->conn, c->sync_counter, to_sync_value(0));
+
+    XSyncAlarmAttributes attributes = {
+        .trigger = {
+            .counter = c->sync_counter,
+            .value_type = XSyncAbsolute,
+            .wait_value = to_sync_value(1),
+            .test_type = XSyncPositiveComparison,
+        },
+        // A zero delta deactivates the alarm once it fires, until it's changed
+        .delta = to_sync_value(0),
+        .events = true,
+    };
+
+    c->sync_alarm = XSyncCreateAlarm(wm->conn, XSyncCACounter | XSyncCAValueType |
+            XSyncCAValue | XSyncCATestType | XSyncCADelta | XSyncCAEvents, &attributes);
+    end_ignoring_errors(wm, first_request);
+}
+
+static void stop_syncing(wm_t *wm, client_t *c)
+{
+    if (c->sync_alarm == None)
+        return;
+
+    unsigned long first_request = begin_ignoring_errors(wm);
+    XSyncDestroyAlarm(wm->conn, c->sync_alarm);
+    end_ignoring_errors(wm, first_request);
+
+    c->sync_alarm = None;
+    c->is_awaiting_sync = false;
+}
+
+static void send_sync_request(wm_t *wm, client_t *c)
+{
+    c->sync_value++;
+    XSyncAlarmAttributes attributes = { .trigger.wait_value = to_sync_value(c->sync_value) };
+
+    XEvent event = {
+        .xclient = {
+            .type = ClientMessage,
+            .window = c->window,
+            .message_type = wm->atoms[ATOM_WM_PROTOCOLS],
+            .format = 32,
+        }
+    };
+
+    event.xclient.data.l[0] = wm->atoms[ATOM_NET_WM_SYNC_REQUEST];
+    event.xclient.data.l[1] = CurrentTime;
+    // The value is 64-bit, split into its low and high halves
+    event.xclient.data.l[2] = c->sync_value & 0xffffffff;
+    event.xclient.data.l[3] = c->sync_value >> 32;
+
+    // Either of them might be gone, which is noticed through DestroyNotify
+    unsigned long first_request = begin_ignoring_errors(wm);
+    XSyncChangeAlarm(wm->conn, c->sync_alarm, XSyncCAValue, &attributes);
+    XSendEvent(wm->conn, c->window, false, NoEventMask, &event);
+    end_ignoring_errors(wm, first_request);
+
+    c->is_awaiting_sync = true;
+    c->sync_deadline = monotonic_time_us() + WM_SYNC_TIMEOUT_MS * 1000LL;
+
+    // Only the earliest deadline is ever armed, later ones are found once it's due
+    if (!wm->timers[TIMER_SYNC] || c->sync_deadline < wm->timers[TIMER_SYNC])
+        arm_timer(wm, TIMER_SYNC, c->sync_deadline);
+}
+
+static void send_geometry(wm_t *wm, client_t *c, int x, int y, int w, int h)
+{
+    // Moving a window does not make it repaint, so there's nothing to wait for
+    if ((c->width != w || c->height != h) && can_sync(wm, c))
+        send_sync_request(wm, c);
+
+    // Several windows might close at once, and a relayout after reading only
+    // the first UnmapNotify still configures the others, which are long gone
+    unsigned long first_request = begin_ignoring_errors(wm);
+    XMoveResizeWindow(wm->conn, c->window, x, y, w, h);
+    end_ignoring_errors(wm, first_request);
+
+    c->x = x, c->y = y;
+    c->width = w, c->height = h;
+
+    wm->stats.configures_sent++;
+}
+
+/*
+ * Only talks to the server if the geometry differs from the one last applied.
+ * Every configure makes the client relayout and repaint, which is expensive
+ * for heavier applications. A client that is still repainting for its last
+ * size is not sent anything else, the latest geometry is kept until it has
+ * caught up, so configures never pile up on its end. Returns true if the
+ * geometry is going to change.
+ */
+static bool move_resize_client(wm_t *wm, client_t *c, int x, int y, int w, int h)
+{
+    if (c->x == x && c->y == y && c->width == w && c->height == h)
     {
-        // The non-floating head of the clients list, also known as the special window,
-        // will capture a whole pane on its own.
-        XMoveResizeWindow(wm->conn, special->window, wm->gap, wm->gap, space->special_width, max_height);
-        const int rem_width = max_width - space->special_width - wm->gap;
+        // Back to where the client already is, whatever was held back is stale
+        c->has_pending_geometry = false;
+        wm->stats.configures_skipped++;
+        return false;
+    }
 
-        // The other windows will just share the remaining space
-        // x * total + gap * (total - 1) = max_height, solve for x
-        int other_height = (max_height - wm->gap * (tiled_clients - 2)) / (tiled_clients - 1);
-        int i = 0;
+    // Plain moves can go through, unless a resize is already waiting its turn
+    const bool is_resize = (c->width != w || c->height != h);
+    if (c->is_awaiting_sync && (is_resize || c->has_pending_geometry))
+    {
+        c->pending_x = x, c->pending_y = y;
+        c->pending_width = w, c->pending_height = h;
+        c->has_pending_geometry = true;
 
-        for (client_t *c = special->next; c; c = c->next)
+        wm->stats.configures_deferred++;
+        return true;
+    }
+
+    send_geometry(wm, c, x, y, w, h);
+    return true;
+}
+
+// The client has repainted, or we got tired of waiting
+static void finish_sync(wm_t *wm, client_t *c)
+{
+    c->is_awaiting_sync = false;
+
+    if (c->has_pending_geometry)
+    {
+        c->has_pending_geometry = false;
+        send_geometry(wm, c, c->pending_x, c->pending_y, c->pending_width, c->pending_height);
+    }
+}
+
+// Alarms are only ever created for managed clients
+static client_t* find_client_by_alarm(wm_t *wm, XSyncAlarm alarm)
+{
+    for (int i = 0; i < total_workspaces(wm); i++)
+        for (client_t *c = wm->workspaces[i].clients.head; c; c = c->next)
+            if (c->sync_alarm == alarm)
+                return c;
+
+    return NULL;
+}
+
+static void on_sync_alarm(wm_t *wm, const XSyncAlarmNotifyEvent *event)
+{
+    client_t *c = find_client_by_alarm(wm, event->alarm);
+
+    // Notifications for an older value might still have been in the queue
+    if (c && c->is_awaiting_sync && from_sync_value(event->counter_value) >= c->sync_value)
+        finish_sync(wm, c);
+}
+
+/*
+ * A client that does not answer in time is sent whatever was held back for
+ * it, and is no longer waited on. A frozen client should not freeze the
+ * layout along with it
+ */
+static void expire_syncs(wm_t *wm)
+{
+    const long long now = monotonic_time_us();
+    long long earliest = 0;
+
+    for (int i = 0; i < total_workspaces(wm); i++)
+    {
+        for (client_t *c = wm->workspaces[i].clients.head; c; c = c->next)
         {
-            if (c->is_floating)
+            if (!c->is_awaiting_sync)
                 continue;
 
-            XMoveResizeWindow(wm->conn, c->window,
-                    space->special_width + 2 * wm->gap, wm->gap + i * (wm->gap + other_height),
-                    rem_width, other_height);
-            i++;
+            if (c->sync_deadline > now)
+            {
+                earliest = earliest ? MIN(earliest, c->sync_deadline) : c->sync_deadline;
+                continue;
+            }
+
+            wm->stats.sync_timeouts++;
+            stop_syncing(wm, c);
+            finish_sync(wm, c);
         }
     }
+
+    if (earliest)
+        arm_timer(wm, TIMER_SYNC, earliest);
 }
 
-static client_t* manage_window(wm_t *wm, Window window)
+/*
+ * Re-calculate all tiling positions in a single workspace
+ * Use mark_dirty() instead of calling this directly, so that multiple
+ * layout changes within the same batch of events only cost a single pass
+ */
+static void tile(wm_t *wm, workspace_t *space)
 {
-    workspace_t *space = get_workspace(wm);
+    space->is_dirty = false;
+    wm->stats.layout_passes++;
 
-    // Start tracking the window inside our internal state
-    client_t *client = create_client(window);
-    clients_insert(&space->clients, client);
+    // Do not consider floating windows
+    int tiled_clients = 0;
+    for (client_t *c = space->clients.head; c; c = c->next)
+        tiled_clients += (!c->is_floating);
+
+    if (tiled_clients == 0) return;
+
+    // The layout itself never talks to the server, check out layouts.h
+    // The bar covers the top of the monitor, so windows are laid out below it
+    const monitor_t *monitor = &wm->monitors[space->monitor];
+    const layout_params_t params = {
+        monitor->width, monitor->height - wm->bar_height, wm->gap, space->special_width
+    };
+    const layout_rect_t *rects =
+        layout_compute(&space->layout_cache, space->layout, &params, tiled_clients);
+
+    // Committing the rectangles, in the same order that they were computed
+    bool has_changed = false;
+    int i = 0;
+
+    for (client_t *c = space->clients.head; c; c = c->next)
+    {
+        if (c->is_floating)
+            continue;
+
+        has_changed |= move_resize_client(wm, c, rects[i].x, wm->bar_height + rects[i].y,
+                rects[i].width, rects[i].height);
+        i++;
+    }
+
+    // Setting to false to prevent EnterNotify events from firing because of
+    // the cursor now being above a brand new window.
+    if (has_changed)
+        wm->has_moved_cursor = false;
+}
 
+// The layout will be re-calculated at the end of the current batch of events
+static inline void mark_dirty(workspace_t *space)
+{
+    space->is_dirty = true;
+}
+
+// Hidden workspaces are left alone, until they are about to become visible
+static void flush_layout(wm_t *wm, workspace_t *space)
+{
+    if (space->is_dirty)
+        PROFILE_CALL(wm, PROFILE_TILE, tile(wm, space));
+}
+
+// Monitors are laid out in isolation, untouched ones cost nothing
+static void flush_visible_layouts(wm_t *wm)
+{
+    for (int i = 0; i < wm->total_monitors; i++)
+        flush_layout(wm, visible_workspace(wm, i));
+}
+
+/*
+ * Everything that a window needs before being handed to us, be it brand new
+ * or restored. The caller should be ignoring errors
+ */
+static void prepare_window(wm_t *wm, Window window)
+{
     // Create a border around the window to indicate whether it's focused
     XWindowChanges wc = { .border_width = WM_BORDER_WIDTH };
     XConfigureWindow(wm->conn, window, CWBorderWidth, &wc);
 
-    XSelectInput(wm->conn, window, EnterWindowMask);
+    // Property changes are needed to keep our cached hints and protocols fresh
+    XSelectInput(wm->conn, window, EnterWindowMask | PropertyChangeMask);
 
     // Stores the list of all client windows managed by the window manager
     // This information is important, particularly during window-manager cleanup
     XAddToSaveSet(wm->conn, window);
 
-    get_size_hints(wm, client);
-    client->is_floating = should_client_float(wm, client);
-
     /*
      * Registering some special key bindings
      * These are unique in some way and do not follow the conventions of config.h
      */
 
-    grab_key(wm, wm_kill_client_key, window);
+    if (kill_client_entry(wm)->keycode)
+        grab_key(wm, kill_client_entry(wm), window);
 
     // Capture move and resize bindings
     XGrabButton(wm->conn, Button1, WM_MOD_MASK, window, false,
@@ -403,7 +1195,21 @@ static client_t* manage_window(wm_t *wm, Window window)
     XGrabButton(wm->conn, Button3, WM_MOD_MASK, window, false,
             ButtonPressMask | ButtonReleaseMask | ButtonMotionMask,
             GrabModeAsync, GrabModeAsync, None, None);
+}
+
+/*
+ * Starts tracking the window, although it will only join a workspace once its
+ * properties have arrived. Check out adopt_pending_clients()
+ */
+static client_t* manage_window(wm_t *wm, Window window)
+{
+    // The window might be gone by the time the server gets to our requests
+    unsigned long first_request = begin_ignoring_errors(wm);
+    client_t *client = create_client(window);
+    properties_request(&wm->properties, client, get_workspace(wm) - wm->workspaces);
+    prepare_window(wm, window);
 
+    end_ignoring_errors(wm, first_request);
     return client;
 }
 
@@ -415,113 +1221,927 @@ static client_t* manage_window(wm_t *wm, Window window)
  */
 static void unmanage_client(wm_t *wm, client_t *client)
 {
-    workspace_t *space = get_workspace(wm);
-    XSetErrorHandler(dummy_error_handler);
+    workspace_t *space = workspace_of(client);
+    ipc_broadcast(&wm->ipc, "event unmap 0x%lx\n", client->window);
+    unsigned long first_request = begin_ignoring_errors(wm);
+    // The client might still be waiting on refreshed properties
+    properties_cancel(&wm->properties, client);
+    stop_syncing(wm, client);
 
     // Remove client from save set, we don't have to deal with them anymore
     XRemoveFromSaveSet(wm->conn, client->window);
     // Destroy window and delete client entry from state
     XDestroyWindow(wm->conn, client->window);
 
+    // The pool is going to hand the same client out again
+    if (client == wm->committed_focus)
+        wm->committed_focus = NULL;
+
     clients_destroy_client(&space->clients, client);
-    visually_reflect_focus(wm, space);
+    wm->is_client_list_dirty = true;
+    // Hidden workspaces will be focused once they are visited again
+    if (space == get_workspace(wm))
+        mark_focus_dirty(wm);
 
     if (client == wm->dragged_client)
         wm->dragged_client = NULL;
 
-    XSync(wm->conn, false);
-    XSetErrorHandler(on_x_error);
+    end_ignoring_errors(wm, first_request);
+}
+
+static void on_unmap_notify(wm_t *wm, const XUnmapEvent *event)
+{
+    // First, ensure that the unmapped window is actually a client that we manage
+    client_t *client = clients_find_by_window(&wm->index, event->window);
+
+    if (!client)
+        return;
+
+    // Workspace switching unmaps windows too, but they are only hidden
+    if (client->ignored_unmaps > 0)
+    {
+        client->ignored_unmaps--;
+        return;
+    }
+
+    /*
+     * The window is invisible, so get rid of it. Since minimized windows will
+     * not be supported, unmap is pretty much identical to destruction
+     */
+    workspace_t *space = workspace_of(client);
+    unmanage_client(wm, client);
+    mark_dirty(space);
+}
+
+static void kill_client(wm_t *wm, Window window)
+{
+    client_t *c = clients_find_by_window(&wm->index, window);
+
+    // Try to be civil and use a WM protocol
+    // If that's not supported, just kill it violently
+    if (!c || !try_send_wm_protocol(wm, c, PROTOCOL_DELETE_WINDOW))
+        XKillClient(wm->conn, window);
+}
+
+/*
+ * Look up the bindings of the pressed keycode in our dispatch table.
+ * If a match is found, call the callback function
+ */
+static void on_key_press(wm_t *wm, const XKeyEvent *event)
+{
+    const unsigned int modifiers = clean_modifiers(wm, event->state);
+
+    for (wm_key_entry_t *e = wm->key_table[event->keycode]; e; e = e->next)
+    {
+        if (e->modifiers != modifiers)
+            continue;
+
+        if (e->binding == -1)
+            return kill_client(wm, event->window);
+
+        const wm_binding_t *binding = &wm_bindings[e->binding];
+        return binding->callback(wm, binding->argument);
+    }
+}
+
+// The keyboard layout has changed, our keycodes and grabs are now stale
+static void on_mapping_notify(wm_t *wm, XMappingEvent *event)
+{
+    XRefreshKeyboardMapping(event);
+    if (event->request == MappingPointer)
+        return;
+
+    build_key_table(wm);
+    create_bindings(wm);
+
+    const wm_key_entry_t *kill_entry = kill_client_entry(wm);
+    unsigned long first_request = begin_ignoring_errors(wm);
+
+    for (int i = 0; i < total_workspaces(wm); i++)
+    {
+        for (client_t *c = wm->workspaces[i].clients.head; c; c = c->next)
+        {
+            XUngrabKey(wm->conn, AnyKey, AnyModifier, c->window);
+            if (kill_entry->keycode)
+                grab_key(wm, kill_entry, c->window);
+        }
+    }
+
+    end_ignoring_errors(wm, first_request);
+}
+
+// Queries outlive the monitors that were unplugged while they were pending
+static workspace_t* queued_workspace(wm_t *wm, int index)
+{
+    if (index < total_workspaces(wm))
+        return &wm->workspaces[index];
+
+    return workspace_on(wm, 0, index % TOTAL_WORKSPACES);
+}
+
+/*
+ * Collects the properties of all windows that were mapped during the latest
+ * batch of events, and only then places them inside their workspaces. The
+ * windows are laid out before being mapped, so they show up in place.
+ */
+static void adopt_pending_clients(wm_t *wm)
+{
+    property_query_t ready[MAX_PENDING_QUERIES];
+
+    // Only the first reply is waited on, see properties_collect()
+    if (wm->properties.total_pending > 0)
+        PROFILE_ROUND_TRIP(wm);
+
+    const int total = properties_collect(&wm->properties, ready);
+    if (total == 0)
+        return;
+
+    const unsigned long first_adoption_request = NextRequest(wm->conn);
+    unsigned long first_request = begin_ignoring_errors(wm);
+
+    for (int i = 0; i < total; i++)
+    {
+        client_t *c = ready[i].client;
+
+        // The counter may have been replaced, so the alarm has to follow it
+        if (ready[i].properties & PROPERTY_SYNC_COUNTER)
+        {
+            stop_syncing(wm, c);
+            finish_sync(wm, c);
+            start_syncing(wm, c);
+        }
+
+        // Refreshed properties have already been stored, nothing else to do
+        if (!ready[i].is_new)
+            continue;
+
+        workspace_t *target = queued_workspace(wm, ready[i].workspace);
+        c->is_floating = should_client_float(wm, c);
+        clients_insert(&target->clients, c);
+        mark_dirty(target);
+
+        ipc_broadcast(&wm->ipc, "event map 0x%lx %d %d\n", c->window,
+                target->monitor, (int) (target - wm->workspaces) % TOTAL_WORKSPACES);
+
+        // Windows are placed relative to the root, but containers are not
+        const monitor_t *monitor = &wm->monitors[target->monitor];
+        if (c->x != -1)
+            c->x -= monitor->x, c->y -= monitor->y;
+
+        // Moved into the container first, so that tile() configures it in
+        // there. The user might have already left this workspace, in which
+        // case the window will just stay invisible inside its unmapped container
+        XReparentWindow(wm->conn, c->window, target->container, c->x, c->y);
+    }
+
+    // Lay the windows out before mapping them, so that they show up in place
+    workspace_t *space = get_workspace(wm);
+    flush_visible_layouts(wm);
+
+    bool has_mapped = false;
+    Window adopted[MAX_PENDING_QUERIES];
+    int total_adopted = 0;
+
+    for (int i = 0; i < total; i++)
+    {
+        client_t *c = ready[i].client;
+        if (!ready[i].is_new)
+            continue;
+
+        workspace_t *target = workspace_of(c);
+        publish_client_desktop(wm, c);
+        adopted[total_adopted++] = c->window;
+
+        XMapWindow(wm->conn, c->window);
+        has_mapped |= (target == space);
+
+        clients_push_focus(&target->clients, c);
+    }
+
+    // The server handles our requests in order, so the windows will
+    // already be mapped by the time it gets to the focus change
+    if (has_mapped)
+        mark_focus_dirty(wm);
+
+    append_client_list(wm, adopted, total_adopted);
+    end_ignoring_errors(wm, first_request);
+
+    // Each adopted window is timed on its own, the requests are shared
+    wm_latency_t *latency = &wm->stats.map_latency;
+    const long long now = monotonic_time_us();
+
+    for (int i = 0; i < total; i++)
+    {
+        if (!ready[i].is_new)
+            continue;
+
+        const long long elapsed = now - ready[i].requested_at;
+        latency->count++;
+        latency->total_us += elapsed;
+        latency->max_us = MAX(latency->max_us, elapsed);
+    }
+
+    latency->requests += NextRequest(wm->conn) - first_adoption_request;
+}
+
+/*
+ * Windows that were mapped before we started (say, after the previous window
+ * manager crashed) never send us a MapRequest. They are all adopted into the
+ * first workspace at once, so that they only need a single layout pass.
+ */
+static void adopt_existing_windows(wm_t *wm)
+{
+    const long long start = monotonic_time_us();
+    Window *windows;
+    const int total = properties_find_mapped_children(&wm->properties, wm->root, &windows);
+
+    for (int i = 0; i < total; i++)
+    {
+        client_t *c = manage_window(wm, windows[i]);
+        // Reparenting a mapped window unmaps it first
+        c->ignored_unmaps++;
+
+        if (properties_is_full(&wm->properties))
+            adopt_pending_clients(wm);
+    }
+
+    adopt_pending_clients(wm);
+    free(windows);
+
+    printf("Adopted %d existing windows in %lld us\n", total, monotonic_time_us() - start);
+}
+
+// Bumped whenever the layout of the saved state changes
+#define RESTART_STATE_VERSION 3
+// In 32-bit units, way more than a few hundred clients will ever need
+#define MAX_RESTART_STATE_LENGTH (1 << 20)
+
+/*
+ * Our state is stored inside a root window property, as a flat array of
+ * 32-bit values: the version, the gap, the active monitor and the number of
+ * monitors. Every monitor then stores its geometry and active workspace,
+ * followed by its workspaces. For each of those we store the container, the
+ * special width, the layout, the number of clients and the number of focus
+ * stack entries,
+ * followed by a (window, is floating) pair for every client in list order
+ * and finally by the focus stack from the top.
+ */
+static void save_state(wm_t *wm)
+{
+    long total = 4 + 5 * wm->total_monitors;
+    for (int i = 0; i < total_workspaces(wm); i++)
+        total += 5 + 3 * wm->workspaces[i].clients.length;
+
+    long *state = malloc(total * sizeof(long));
+    if (!state)
+        log_fatal("failed to allocate memory for restart state");
+
+    long *s = state;
+    *s++ = RESTART_STATE_VERSION;
+    *s++ = wm->gap;
+    *s++ = wm->active_monitor;
+    *s++ = wm->total_monitors;
+
+    for (int m = 0; m < wm->total_monitors; m++)
+    {
+        const monitor_t *monitor = &wm->monitors[m];
+        *s++ = monitor->x, *s++ = monitor->y;
+        *s++ = monitor->width, *s++ = monitor->height;
+        *s++ = monitor->active_workspace;
+
+        for (int i = 0; i < TOTAL_WORKSPACES; i++)
+        {
+            const workspace_t *space = workspace_on(wm, m, i);
+            const client_list_t *clients = &space->clients;
+
+            *s++ = space->container;
+            *s++ = space->special_width;
+            *s++ = space->layout;
+            *s++ = clients->length;
+            long *total_focused = s++;
+
+            for (client_t *c = clients->head; c; c = c->next)
+                *s++ = c->window, *s++ = c->is_floating;
+
+            *total_focused = 0;
+            for (client_t *c = clients->focus_stack; c; c = c->focus_next)
+                *s++ = c->window, (*total_focused)++;
+        }
+    }
+
+    // Xlib passes format 32 properties around as longs, even on 64-bit machines
+    XChangeProperty(wm->conn, wm->root, wm->atoms[ATOM_WM_RESTART_STATE], XA_CARDINAL, 32,
+            PropModeReplace, (unsigned char*) state, s - state);
+    free(state);
+}
+
+static bool contains_window(const Window *windows, int total, Window window)
+{
+    for (int i = 0; i < total; i++)
+        if (windows[i] == window)
+            return true;
+
+    return false;
+}
+
+static void restore_workspace(wm_t *wm, workspace_t *space, Window container,
+                              const long *clients, long total_clients,
+                              const long *focused, long total_focused)
+{
+    Window *children;
+    const int total_children =
+        properties_find_mapped_children(&wm->properties, container, &children);
+
+    // Someone might have destroyed the container in the meantime
+    if (total_children < 0)
+        return;
+
+    space->container = container;
+    XSelectInput(wm->conn, container,
+            SubstructureRedirectMask | SubstructureNotifyMask | EnterWindowMask);
+
+    unsigned long first_request = begin_ignoring_errors(wm);
+
+    // Insertion happens at the head of the list, so go through it backwards
+    for (long i = total_clients - 1; i >= 0; i--)
+    {
+        // Nobody was around to tell us about windows that went away
+        const Window window = clients[2 * i];
+        if (!contains_window(children, total_children, window))
+            continue;
+
+        client_t *c = create_client(window);
+        c->is_floating = clients[2 * i + 1];
+        prepare_window(wm, window);
+        clients_insert(&space->clients, c);
+
+        // The geometry has to be known before laying the workspace out,
+        // so that the unchanged windows are not configured at all
+        properties_refresh(&wm->properties, c, PROPERTY_ALL);
+        if (properties_is_full(&wm->properties))
+            adopt_pending_clients(wm);
+    }
+
+    // The top of the stack has to be pushed last
+    for (long i = total_focused - 1; i >= 0; i--)
+    {
+        client_t *c = clients_find_by_window(&wm->index, focused[i]);
+        if (c && workspace_of(c) == space)
+            clients_push_focus(&space->clients, c);
+    }
+
+    end_ignoring_errors(wm, first_request);
+    mark_dirty(space);
+    free(children);
+}
+
+static void initialize_monitor(wm_t *wm, int monitor)
+{
+    wm->monitors[monitor].active_workspace = 0;
+
+    for (int i = 0; i < TOTAL_WORKSPACES; i++)
+    {
+        workspace_t *space = workspace_on(wm, monitor, i);
+
+        space->special_width = wm->monitors[monitor].width / 2;
+        space->layout = LAYOUT_MASTER_STACK;
+        layout_cache_initialize(&space->layout_cache);
+        space->is_dirty = false;
+        space->container = None;
+        space->monitor = monitor;
+        clients_initialize(&space->clients, &wm->index);
+    }
+}
+
+/*
+ * Picks up the state left behind by wm_restart(). The clients never left
+ * their containers, so nothing has to be mapped, moved or reparented.
+ * Monitors are restored as they were, update_monitors() takes care of any
+ * outputs that changed in the meantime.
+ * Returns false if we were not started through a restart
+ */
+static bool restore_state(wm_t *wm)
+{
+    Atom type;
+    int format;
+    unsigned long total, remaining;
+    unsigned char *data = NULL;
+
+    // Deleted right away, a crash during restoration should not repeat itself
+    if (XGetWindowProperty(wm->conn, wm->root, wm->atoms[ATOM_WM_RESTART_STATE], 0,
+            MAX_RESTART_STATE_LENGTH, true, XA_CARDINAL, &type, &format,
+            &total, &remaining, &data) != Success || !data)
+    {
+        return false;
+    }
+
+    const long *state = (const long*) data;
+    if (format != 32 || total < 4 || state[0] != RESTART_STATE_VERSION)
+    {
+        XFree(data);
+        return false;
+    }
+
+    wm->gap = state[1];
+    const long active_monitor = state[2];
+    const long total_monitors = MIN(state[3], MAX_MONITORS);
+
+    unsigned long at = 4;
+    for (int m = 0; m < total_monitors && at + 5 <= total; m++)
+    {
+        monitor_t *monitor = &wm->monitors[m];
+        monitor->x = state[at], monitor->y = state[at + 1];
+        monitor->width = state[at + 2], monitor->height = state[at + 3];
+        initialize_monitor(wm, m);
+
+        if (state[at + 4] >= 0 && state[at + 4] < TOTAL_WORKSPACES)
+            monitor->active_workspace = state[at + 4];
+
+        wm->total_monitors = m + 1;
+        at += 5;
+
+        for (int i = 0; i < TOTAL_WORKSPACES && at + 5 <= total; i++)
+        {
+            const Window container = state[at];
+            const long layout = state[at + 2];
+            const long total_clients = state[at + 3];
+            const long total_focused = state[at + 4];
+            at += 5;
+
+            // Don't trust the lengths blindly, the property could have been tampered with
+            if (total_clients < 0 || total_focused < 0 ||
+                at + 2 * total_clients + total_focused > total)
+            {
+                at = total;
+                break;
+            }
+
+            workspace_t *space = workspace_on(wm, m, i);
+            space->special_width = state[at - 4];
+            if (layout >= 0 && layout < TOTAL_LAYOUTS)
+                space->layout = layout;
+            restore_workspace(wm, space, container,
+                    &state[at], total_clients, &state[at + 2 * total_clients], total_focused);
+            at += 2 * total_clients + total_focused;
+        }
+    }
+
+    if (active_monitor >= 0 && active_monitor < wm->total_monitors)
+        wm->active_monitor = active_monitor;
+
+    XFree(data);
+    return true;
+}
+
+/*
+ * Leaves every client exactly where it is for the next instance. Retained
+ * resources outlive our connection, so the containers will be waiting for
+ * it. The clients are taken out of our save-set, or else the server would
+ * move them back to the root window as soon as we disconnect.
+ */
+static void hand_over(wm_t *wm)
+{
+    save_state(wm);
+    unsigned long first_request = begin_ignoring_errors(wm);
+
+    for (int i = 0; i < total_workspaces(wm); i++)
+    {
+        for (client_t *c = wm->workspaces[i].clients.head; c; c = c->next)
+        {
+            XRemoveFromSaveSet(wm->conn, c->window);
+            // Unlike the containers, alarms are of no use to the next instance
+            if (c->sync_alarm != None)
+                XSyncDestroyAlarm(wm->conn, c->sync_alarm);
+        }
+
+        // Only a single client may redirect a window, the next instance needs it
+        XSelectInput(wm->conn, wm->workspaces[i].container, NoEventMask);
+    }
+
+    end_ignoring_errors(wm, first_request);
+    XSetCloseDownMode(wm->conn, RetainTemporary);
+}
+
+/*
+ * Frees everything that we created on the server, other than the containers.
+ * On a restart the connection retains its resources, so anything left over
+ * would be leaked by every single restart. The property connection is not
+ * affected, it is closed the usual way. Grabs and event selections are never
+ * retained by the server
+ */
+static void free_server_resources(wm_t *wm)
+{
+    for (int i = 0; i < MAX_MONITORS; i++)
+        bar_close(&wm->bars[i]);
+    if (wm->bar_height)
+        bar_free_theme(&wm->bar_theme);
+
+    // The next instance publishes a check window of its own
+    XDestroyWindow(wm->conn, wm->check_window);
+
+    // The root keeps its own reference, so it does not lose its cursor
+    XFreeCursor(wm->conn, wm->cursor);
+    XFreeColors(wm->conn, wm->colormap, wm->allocated_pixels, wm->total_allocated_pixels, 0);
+}
+
+/*
+ * Gives every client back to the root window. The server would do this on
+ * its own through the save-set, but not for containers that were created by
+ * a previous instance of the window manager
+ */
+static void release_clients(wm_t *wm)
+{
+    unsigned long first_request = begin_ignoring_errors(wm);
+
+    for (int i = 0; i < total_workspaces(wm); i++)
+    {
+        workspace_t *space = &wm->workspaces[i];
+        const monitor_t *monitor = &wm->monitors[space->monitor];
+
+        // Containers cover their whole monitor, so the windows stay in place
+        for (client_t *c = space->clients.head; c; c = c->next)
+            XReparentWindow(wm->conn, c->window, wm->root,
+                    monitor->x + MAX(c->x, 0), monitor->y + MAX(c->y, 0));
+
+        XDestroyWindow(wm->conn, space->container);
+    }
+
+    end_ignoring_errors(wm, first_request);
+
+    // Nothing is managed anymore, panels should not be left with stale state
+    const wm_atom_e published[] = {
+        ATOM_NET_SUPPORTING_WM_CHECK, ATOM_NET_SUPPORTED, ATOM_NET_CLIENT_LIST,
+        ATOM_NET_NUMBER_OF_DESKTOPS, ATOM_NET_CURRENT_DESKTOP, ATOM_NET_ACTIVE_WINDOW,
+    };
+
+    for (int i = 0; i < ARRAY_LEN(published); i++)
+        XDeleteProperty(wm->conn, wm->root, wm->atoms[published[i]]);
+}
+
+// Fills in the geometry of every output, returns how many there are
+static int query_monitors(wm_t *wm, monitor_t *monitors)
+{
+#ifdef WM_XRANDR
+    int total = 0;
+    PROFILE_ROUND_TRIP(wm);
+    XRRMonitorInfo *info = XRRGetMonitors(wm->conn, wm->root, true, &total);
+
+    total = MIN(total, MAX_MONITORS);
+    for (int i = 0; i < total; i++)
+    {
+        monitors[i].x = info[i].x, monitors[i].y = info[i].y;
+        monitors[i].width = info[i].width, monitors[i].height = info[i].height;
+    }
+
+    if (info)
+        XRRFreeMonitors(info);
+    if (total > 0)
+        return total;
+#endif
+
+    // Without RandR the whole screen is treated as a single monitor
+    const int screen = DefaultScreen(wm->conn);
+    monitors[0].x = monitors[0].y = 0;
+    monitors[0].width = DisplayWidth(wm->conn, screen);
+    monitors[0].height = DisplayHeight(wm->conn, screen);
+    return 1;
+}
+
+// Creates the containers that are still missing, showing the visible ones
+static void create_containers(wm_t *wm)
+{
+    for (int i = 0; i < total_workspaces(wm); i++)
+    {
+        workspace_t *space = &wm->workspaces[i];
+        if (space->container)
+            continue;
+
+        space->container = create_container(wm, &wm->monitors[space->monitor]);
+        if (space == visible_workspace(wm, space->monitor))
+            XMapWindow(wm->conn, space->container);
+    }
+}
+
+// Moves every client of an unplugged monitor's workspace over to another one
+static void merge_workspace(wm_t *wm, workspace_t *source, workspace_t *target)
+{
+    const monitor_t *from = &wm->monitors[source->monitor];
+    const monitor_t *to = &wm->monitors[target->monitor];
+    unsigned long first_request = begin_ignoring_errors(wm);
+
+    // Taking them from the tail, so that their order is preserved
+    for (client_t *c = source->clients.tail; c; c = source->clients.tail)
+    {
+        clients_remove_focus(&source->clients, c);
+        clients_remove_client(&source->clients, c);
+        clients_insert(&target->clients, c);
+
+        // Floating windows should keep their position on the screen
+        c->x += from->x - to->x, c->y += from->y - to->y;
+        XReparentWindow(wm->conn, c->window, target->container, c->x, c->y);
+        // The server unmaps the window before moving it, as with wm_send_to_workspace()
+        c->ignored_unmaps++;
+        publish_client_desktop(wm, c);
+
+        if (c == wm->dragged_client)
+            wm->dragged_client = NULL;
+        // Reparenting the focused window reverts the input focus
+        if (c == wm->committed_focus)
+            wm->is_focus_lost = true, mark_focus_dirty(wm);
+    }
+
+    XDestroyWindow(wm->conn, source->container);
+    source->container = None;
+    layout_cache_destroy(&source->layout_cache);
+
+    end_ignoring_errors(wm, first_request);
+    mark_dirty(target);
+}
+
+/*
+ * Matches our monitors against the current outputs, by their order. Outputs
+ * that were plugged in get a fresh set of workspaces, and the workspaces of
+ * unplugged ones are merged into those of the first monitor. Only monitors
+ * whose geometry actually changed are laid out again.
+ */
+static void update_monitors(wm_t *wm)
+{
+    monitor_t monitors[MAX_MONITORS];
+    const int total = query_monitors(wm, monitors);
+
+    // Merging needs the containers of the first monitor to exist
+    create_containers(wm);
+
+    for (int m = total; m < wm->total_monitors; m++)
+        for (int i = 0; i < TOTAL_WORKSPACES; i++)
+            merge_workspace(wm, workspace_on(wm, m, i), workspace_on(wm, 0, i));
+
+    for (int m = 0; m < total; m++)
+    {
+        monitor_t *monitor = &wm->monitors[m];
+        if (m >= wm->total_monitors)
+        {
+            *monitor = monitors[m];
+            initialize_monitor(wm, m);
+            continue;
+        }
+
+        if (monitor->x == monitors[m].x && monitor->y == monitors[m].y &&
+            monitor->width == monitors[m].width && monitor->height == monitors[m].height)
+        {
+            continue;
+        }
+
+        monitor->x = monitors[m].x, monitor->y = monitors[m].y;
+        monitor->width = monitors[m].width, monitor->height = monitors[m].height;
+
+        for (int i = 0; i < TOTAL_WORKSPACES; i++)
+        {
+            workspace_t *space = workspace_on(wm, m, i);
+            XMoveResizeWindow(wm->conn, space->container, monitor->x, monitor->y,
+                    monitor->width, monitor->height);
+
+            space->special_width = monitor->width / 2;
+            mark_dirty(space);
+        }
+    }
+
+    wm->total_monitors = total;
+    create_containers(wm);
+
+    if (wm->active_monitor >= total)
+    {
+        wm->active_monitor = 0;
+        mark_focus_dirty(wm);
+    }
+
+    publish_desktops(wm);
+    place_bars(wm);
+}
+
+// Moves the keyboard focus, along with all workspace bindings, to another monitor
+static void focus_monitor(wm_t *wm, int monitor)
+{
+    if (wm->active_monitor == monitor)
+        return;
+
+    wm->active_monitor = monitor;
+    mark_focus_dirty(wm);
+    publish_current_desktop(wm);
+
+    ipc_broadcast(&wm->ipc, "event monitor %d\n", monitor);
+}
+
+/*
+ * A toplevel window (substructure redirection) requests to be mapped
+ * Start keeping track of it, it will get mapped at the end of this batch
+ */
+static void on_map_request(wm_t *wm, const XMapRequestEvent *event)
+{
+    // We might have been asked to map the same window twice in a single batch
+    if (properties_find_pending(&wm->properties, event->window))
+        return;
+
+    const unsigned long first_request = NextRequest(wm->conn);
+    manage_window(wm, event->window);
+    wm->stats.map_latency.requests += NextRequest(wm->conn) - first_request;
+
+    if (properties_is_full(&wm->properties))
+        adopt_pending_clients(wm);
 }
 
-static void on_unmap_notify(wm_t *wm, const XUnmapEvent *event)
+/*
+ * A window might destroy itself before we even get the chance to adopt it.
+ * Windows on hidden workspaces are already unmapped, so this is the only
+ * notification we'll ever get about them going away.
+ */
+static void on_destroy_notify(wm_t *wm, const XDestroyWindowEvent *event)
 {
-    workspace_t *space = get_workspace(wm);
-    // First, ensure that the unmapped window is actually a client that we manage
-    client_t *client = clients_find_by_window(&space->clients, event->window);
+    client_t *c = properties_find_pending(&wm->properties, event->window);
 
-    if (!client)
-        return;
-
-    /*
-     * The window is invisible, so get rid of it. Since minimized windows will
-     * not be supported, unmap is pretty much identical to destruction
-     *
-     * Workspace switching will thankfully never reach this line, since the
-     * window does not belong on the current workspace anymore.
-     */
-    unmanage_client(wm, client);
-    tile(wm, space);
+    if (c && properties_cancel(&wm->properties, c))
+    {
+        destroy_client(c);
+    }
+    else if ((c = clients_find_by_window(&wm->index, event->window)))
+    {
+        workspace_t *space = workspace_of(c);
+        unmanage_client(wm, c);
+        mark_dirty(space);
+    }
 }
 
-static void kill_client(wm_t *wm, Window window)
+static client_t* find_client_anywhere(wm_t *wm, Window window)
 {
-    // Try to be civil and use a WM protocol
-    // If that's not supported, just kill it violently
-    if (!try_send_wm_protocol(wm, window, wm->atoms[ATOM_WM_DELETE_WINDOW]))
-        XKillClient(wm->conn, window);
+    client_t *c = properties_find_pending(&wm->properties, window);
+    return c ? c : clients_find_by_window(&wm->index, window);
 }
 
 /*
- * Just iterate over our global key bindings as defined in config.h.
- * If a match is found, call the callback function
+ * Cached client properties are only ever invalidated over here. The new value
+ * is requested right away, but it will only be stored at the end of this batch
  */
-static void on_key_press(wm_t *wm, const XKeyEvent *event)
+static void on_property_notify(wm_t *wm, const XPropertyEvent *event)
 {
-    const wm_key_t key = key_event_to_key(wm, event);
+    unsigned int property;
 
-    if (are_keys_equal(wm_kill_client_key, key))
-        return kill_client(wm, event->window);
-
-    for (int i = 0; i < ARRAY_LEN(wm_bindings); i++)
+    // The bar will pick it up at the end of the batch
+    if (event->window == wm->root)
     {
-        if (are_keys_equal(wm_bindings[i].key, key))
-            return wm_bindings[i].callback(wm, wm_bindings[i].argument);
+        if (event->atom == XA_WM_NAME && wm->bar_height)
+            update_status(wm);
+        return;
     }
+
+    if (event->atom == XA_WM_NORMAL_HINTS)
+        property = PROPERTY_NORMAL_HINTS;
+    else if (event->atom == wm->atoms[ATOM_WM_PROTOCOLS])
+        property = PROPERTY_PROTOCOLS;
+    else if (event->atom == wm->atoms[ATOM_WM_WINDOW_TYPE])
+        property = PROPERTY_WINDOW_TYPE;
+    else if (event->atom == XA_WM_NAME)
+        property = PROPERTY_TITLE;
+    else if (event->atom == wm->atoms[ATOM_NET_WM_SYNC_REQUEST_COUNTER])
+        property = PROPERTY_SYNC_COUNTER;
+    else
+        return;
+
+    client_t *c = find_client_anywhere(wm, event->window);
+    if (!c)
+        return;
+
+    if (properties_is_full(&wm->properties))
+        adopt_pending_clients(wm);
+
+    properties_refresh(&wm->properties, c, property);
 }
 
 /*
- * A toplevel window (substructure redirection) requests to be mapped
- * Map it and start keeping track of it
+ * Tells a client where it actually is, whenever its ConfigureRequest did not
+ * change anything. ICCCM expects this synthetic event, in root coordinates,
+ * since the server only sends a real one if the window did change.
  */
-static void on_map_request(wm_t *wm, const XMapRequestEvent *event)
+static void send_configure_notify(wm_t *wm, client_t *c)
 {
-    workspace_t *space = get_workspace(wm);
-
-    client_t *c = manage_window(wm, event->window);
-    XMapWindow(wm->conn, event->window);
-
-    // Wait until the mapping request is done, and only then change focus!
-    XSync(wm->conn, false);
-    focus_client(wm, space, c);
+    const monitor_t *monitor = &wm->monitors[workspace_of(c)->monitor];
+
+    XEvent event = {
+        .xconfigure = {
+            .type = ConfigureNotify,
+            .event = c->window,
+            .window = c->window,
+            // Containers are placed right at the origin of their monitor
+            .x = monitor->x + c->x,
+            .y = monitor->y + c->y,
+            .width = c->width,
+            .height = c->height,
+            .border_width = WM_BORDER_WIDTH,
+            .above = None,
+            .override_redirect = false,
+        }
+    };
 
-    tile(wm, space);
+    unsigned long first_request = begin_ignoring_errors(wm);
+    XSendEvent(wm->conn, c->window, false, StructureNotifyMask, &event);
+    end_ignoring_errors(wm, first_request);
 }
 
+/*
+ * Windows that we don't manage yet (or at all) get exactly what they ask for.
+ * Tiled clients are placed by tile() alone: letting them pick their own size
+ * would only have the next layout pass undo it, and some applications answer
+ * that with another request, going back and forth forever. They're just told
+ * where they are. Floating clients are free to move and resize, within their
+ * size hints. The border is always ours to decide.
+ */
 static void on_configure_request(wm_t *wm, const XConfigureRequestEvent *event)
 {
-    XWindowChanges changes = {
-        .x = event->x,
-        .y = event->y,
-        .width = event->width,
-        .height = event->height,
-        .border_width = event->border_width,
-        .sibling = event->above,
-        .stack_mode = event->detail,
-    };
+    client_t *c = clients_find_by_window(&wm->index, event->window);
+
+    if (!c)
+    {
+        XWindowChanges changes = {
+            .x = event->x,
+            .y = event->y,
+            .width = event->width,
+            .height = event->height,
+            .border_width = event->border_width,
+            .sibling = event->above,
+            .stack_mode = event->detail,
+        };
+
+        XConfigureWindow(wm->conn, event->window, event->value_mask, &changes);
+        wm->stats.configure_requests_honored++;
+        return;
+    }
+
+    // Missing fields stand for the current value
+    const unsigned long mask = event->value_mask;
+    int x = (mask & CWX) ? event->x : c->x;
+    int y = (mask & CWY) ? event->y : c->y;
+    int w = (mask & CWWidth) ? event->width : c->width;
+    int h = (mask & CWHeight) ? event->height : c->height;
+    const bool is_unchanged = (x == c->x && y == c->y && w == c->width && h == c->height);
+
+    if (!c->is_floating)
+    {
+        if (is_unchanged)
+            wm->stats.configure_requests_dropped++;
+        else
+            wm->stats.configure_requests_rewritten++;
+
+        return send_configure_notify(wm, c);
+    }
+
+    // Same as with dragging, an explicit size range is respected
+    const int requested_w = w, requested_h = h;
+    if (c->max_width != -1) w = MIN(w, c->max_width);
+    if (c->min_width != -1) w = MAX(w, c->min_width);
+    if (c->max_height != -1) h = MIN(h, c->max_height);
+    if (c->min_height != -1) h = MAX(h, c->min_height);
+    w = MAX(1, w), h = MAX(1, h);
+
+    // Only the stacking part is forwarded as it is
+    if (mask & CWStackMode)
+    {
+        XWindowChanges changes = { .sibling = event->above, .stack_mode = event->detail };
+        unsigned long first_request = begin_ignoring_errors(wm);
+        XConfigureWindow(wm->conn, c->window, mask & (CWSibling | CWStackMode), &changes);
+        end_ignoring_errors(wm, first_request);
+    }
+
+    // Whatever size is applied, the server reports it through a real ConfigureNotify
+    if (!move_resize_client(wm, c, x, y, w, h))
+    {
+        wm->stats.configure_requests_dropped++;
+        return send_configure_notify(wm, c);
+    }
 
-    // TODO: Should all requests be allowed?
-    XConfigureWindow(wm->conn, event->window, event->value_mask, &changes);
+    if (w != requested_w || h != requested_h ||
+        ((mask & CWBorderWidth) && event->border_width != WM_BORDER_WIDTH))
+    {
+        wm->stats.configure_requests_rewritten++;
+    }
+    else
+        wm->stats.configure_requests_honored++;
 }
 
 static void on_enter_notify(wm_t *wm, const XCrossingEvent *event)
 {
     if (!wm->has_moved_cursor) return;
-    workspace_t *space = get_workspace(wm);
+    client_t *client = find_visible_client(wm, event->window);
 
-    client_t *client = clients_find_by_window(&space->clients, event->window);
-    
     if (client)
-        focus_client(wm, space, client);
+    {
+        focus_monitor(wm, workspace_of(client)->monitor);
+        focus_client(wm, get_workspace(wm), client);
+        return;
+    }
+
+    // The pointer moved onto an empty part of some other monitor
+    for (int i = 0; i < wm->total_monitors; i++)
+        if (visible_workspace(wm, i)->container == event->window)
+            focus_monitor(wm, i);
 }
 
 static void on_button_press(wm_t *wm, const XButtonEvent *event)
@@ -530,17 +2150,18 @@ static void on_button_press(wm_t *wm, const XButtonEvent *event)
      * Will trigger manual floating window resizing and positioning. We're going
      * to be storing the initial position and size as a reference point. 
      */
-    workspace_t *space = get_workspace(wm);
-    client_t *c = clients_find_by_window(&space->clients, event->window);
+    client_t *c = find_visible_client(wm, event->window);
     if (!c)
         return;
 
+    workspace_t *space = workspace_of(c);
     wm->drag_cursor_x = event->x_root;
     wm->drag_cursor_y = event->y_root;
 
     Window root;
     unsigned int border_width, depth;
 
+    PROFILE_ROUND_TRIP(wm);
     if (!XGetGeometry(wm->conn, c->window, &root,
             &wm->drag_window_x, &wm->drag_window_y,
             &wm->drag_window_w, &wm->drag_window_h, &border_width, &depth))
@@ -548,22 +2169,79 @@ static void on_button_press(wm_t *wm, const XButtonEvent *event)
         log_fatal("failed to fetch geometry of client during button press");
     }
 
+    // Dragging moves and resizes relative to this, so make sure it's accurate
+    c->x = wm->drag_window_x, c->y = wm->drag_window_y;
+    c->width = wm->drag_window_w, c->height = wm->drag_window_h;
+
+    // Motion only ever updates the position or the size, the rest stays put
+    wm->drag_target_x = c->x, wm->drag_target_y = c->y;
+    wm->drag_target_w = c->width, wm->drag_target_h = c->height;
+
+    unsigned long first_request = begin_ignoring_errors(wm);
     XRaiseWindow(wm->conn, c->window);
+    end_ignoring_errors(wm, first_request);
     wm->dragged_client = c;
 
     // The window should now be floating if it isn't already
     if (!c->is_floating)
     {
         c->is_floating = true;
-        tile(wm, space);
+        mark_dirty(space);
+        ipc_broadcast(&wm->ipc, "event float 0x%lx 1\n", c->window);
+    }
+}
+
+// Minimum time between two geometry updates of the dragged window
+static const long long drag_interval = 1000000 / WM_DRAG_REFRESH_RATE;
+
+static void commit_drag(wm_t *wm)
+{
+    client_t *c = wm->dragged_client;
+
+    if (c && wm->has_pending_drag)
+    {
+        move_resize_client(wm, c, wm->drag_target_x, wm->drag_target_y,
+                wm->drag_target_w, wm->drag_target_h);
+
+        wm->stats.drag_commits++;
+        wm->last_drag_commit = monotonic_time_us();
     }
+
+    wm->has_pending_drag = false;
+    disarm_timer(wm, TIMER_DRAG);
 }
 
 static void on_button_release(wm_t *wm, const XButtonEvent *event)
 {
+    // The window should end up exactly where the pointer was released
+    commit_drag(wm);
     wm->dragged_client = NULL;
 }
 
+// Used to scan the event queue, see is_queued_drag_motion()
+typedef struct
+{
+    Window window;
+    bool has_released;
+} drag_scan_t;
+
+/*
+ * Matches the motion of the dragged window, up until the first queued
+ * ButtonRelease. Anything past it belongs after the drag, and has to be
+ * handled in order. Called by Xlib for every queued event, front to back
+ */
+static Bool is_queued_drag_motion(Display *conn, XEvent *event, XPointer arg)
+{
+    (void) conn;
+    drag_scan_t *scan = (drag_scan_t*) arg;
+
+    if (event->type == ButtonRelease)
+        scan->has_released = true;
+
+    return !scan->has_released && event->type == MotionNotify &&
+        event->xmotion.window == scan->window;
+}
+
 static void on_motion_notify(wm_t *wm, const XMotionEvent *event)
 {
     wm->has_moved_cursor = true;
@@ -572,12 +2250,21 @@ static void on_motion_notify(wm_t *wm, const XMotionEvent *event)
     if (!c)
         return;
 
+    // Only the latest pointer position matters, skip over all queued motion
+    XEvent latest;
+    drag_scan_t scan = { .window = c->window };
+    while (XCheckIfEvent(wm->conn, &latest, is_queued_drag_motion, (XPointer) &scan))
+    {
+        event = &latest.xmotion;
+        wm->stats.drag_motions++;
+    }
+    wm->stats.drag_motions++;
+
     // The user is trying to move the window
     if (event->state & Button1Mask)
     {
-        XMoveWindow(wm->conn, c->window,
-            wm->drag_window_x + (event->x_root - wm->drag_cursor_x),
-            wm->drag_window_y + (event->y_root - wm->drag_cursor_y));
+        wm->drag_target_x = wm->drag_window_x + (event->x_root - wm->drag_cursor_x);
+        wm->drag_target_y = wm->drag_window_y + (event->y_root - wm->drag_cursor_y);
     }
     else if (event->state & Button3Mask)
     {
@@ -590,62 +2277,425 @@ static void on_motion_notify(wm_t *wm, const XMotionEvent *event)
         if (c->max_height != -1) new_h = MIN(new_h, c->max_height);
         if (c->min_height != -1) new_h = MAX(new_h, c->min_height);
 
-        new_w = MAX(5, new_w);
-        new_h = MAX(5, new_h);
+        wm->drag_target_w = MAX(5, new_w);
+        wm->drag_target_h = MAX(5, new_h);
+    }
+    else
+        return;
+
+    // Anything faster than the refresh rate is wasted work for both the
+    // server and the client. The main loop will commit it once it's due
+    wm->has_pending_drag = true;
+    const long long deadline = wm->last_drag_commit + drag_interval;
+
+    if (monotonic_time_us() >= deadline)
+        commit_drag(wm);
+    else
+        arm_timer(wm, TIMER_DRAG, deadline);
+}
+
+static bar_t* find_bar(wm_t *wm, Window window)
+{
+    for (int i = 0; i < wm->total_monitors; i++)
+        if (bar_is_open(&wm->bars[i]) && wm->bars[i].window == window)
+            return &wm->bars[i];
+
+    return NULL;
+}
+
+static void on_expose(wm_t *wm, const XExposeEvent *event)
+{
+    bar_t *bar = find_bar(wm, event->window);
+    if (bar)
+        bar_handle_expose(bar, event);
+}
+
+static void on_bar_completion(wm_t *wm, const XShmCompletionEvent *event)
+{
+    bar_t *bar = find_bar(wm, event->drawable);
+    if (bar)
+        bar_handle_completion(bar);
+}
+
+static void handle_event(wm_t *wm, XEvent *event)
+{
+#ifdef WM_XRANDR
+    // Extension events are numbered at runtime, so they can't be part of the switch
+    if (event->type == wm->randr_event_base + RRScreenChangeNotify)
+    {
+        XRRUpdateConfiguration(event);
+        return update_monitors(wm);
+    }
+#endif
+
+    if (wm->has_sync && event->type == wm->sync_event_base + XSyncAlarmNotify)
+        return on_sync_alarm(wm, (XSyncAlarmNotifyEvent*) event);
+
+    // ShmCompletion is numbered at runtime too, and the theme is only loaded with the bar
+    if (wm->bar_height && event->type == wm->bar_theme.completion_event)
+        return on_bar_completion(wm, (XShmCompletionEvent*) event);
+
+    switch (event->type)
+    {
+        case KeyPress: on_key_press(wm, &event->xkey); break;
+        case MappingNotify: on_mapping_notify(wm, &event->xmapping); break;
+        case ButtonPress: on_button_press(wm, &event->xbutton); break;
+        case ButtonRelease: on_button_release(wm, &event->xbutton); break;
+
+        // Requests refer to actions that have not yet been executed
+        // It's the window manager's duty to either ignore or apply them
+        case ConfigureRequest: on_configure_request(wm, &event->xconfigurerequest); break;
+        case MapRequest: on_map_request(wm, &event->xmaprequest); break;
+
+        // Notifications will just inform the WM that a decision has been made
+        // We can't recall them, we just react to them
+        case UnmapNotify: on_unmap_notify(wm, &event->xunmap); break;
+        case DestroyNotify: on_destroy_notify(wm, &event->xdestroywindow); break;
+        case PropertyNotify: on_property_notify(wm, &event->xproperty); break;
+        case EnterNotify: on_enter_notify(wm, &event->xcrossing); break;
+        case MotionNotify: on_motion_notify(wm, &event->xmotion); break;
+        case Expose: on_expose(wm, &event->xexpose); break;
+    }
+}
+
+static void run_due_timers(wm_t *wm)
+{
+    const long long now = monotonic_time_us();
+
+    for (int i = 0; i < TOTAL_TIMERS; i++)
+    {
+        if (!wm->timers[i] || wm->timers[i] > now)
+            continue;
+
+        wm->timers[i] = 0;
+        switch (i)
+        {
+            case TIMER_DRAG: commit_drag(wm); break;
+            case TIMER_SYNC: expire_syncs(wm); break;
+        }
+    }
+
+    update_timer_fd(wm);
+}
+
+static void handle_signals(wm_t *wm)
+{
+    struct signalfd_siginfo info;
+
+    while (read(wm->signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        switch (info.ssi_signo)
+        {
+            case SIGCHLD:
+                // Multiple exits might have been merged into a single signal
+                while (waitpid(-1, NULL, WNOHANG) > 0);
+                break;
+
+            case SIGINT:
+            case SIGTERM:
+                wm->is_running = false;
+                break;
+
+            // Only does anything in profiling builds, check out profile.h
+            case SIGUSR1:
+                PROFILE_REPORT(wm);
+                break;
+        }
+    }
+}
+
+static void process_x_events(wm_t *wm)
+{
+    XEvent event;
+
+    // Unlike XPending, this does not flush our output buffer each time
+    while (wm->is_running && XEventsQueued(wm->conn, QueuedAfterReading))
+    {
+        XNextEvent(wm->conn, &event);
+        PROFILE_CALL(wm, profile_handler_of_event(event.type), handle_event(wm, &event));
+    }
+}
+
+/*
+ * Commands accepted over the IPC socket, named after the binding callbacks.
+ * Workspaces are numbered from 0, just like the bindings of config.h
+ */
+typedef struct
+{
+    const char *name;
+    void (*callback)(wm_t*, const wm_arg_t);
+    // Whether the command expects an integer argument (wm_arg_t.amount)
+    bool has_amount;
+} wm_command_t;
+
+static const wm_command_t wm_commands[] = {
+    { "quit", wm_quit, false },
+    { "restart", wm_restart, false },
+    { "adjust-special-width", wm_adjust_special_width, true },
+    { "reset-special-width", wm_reset_special_width, false },
+    { "adjust-gap", wm_adjust_gap, true },
+    { "cycle-layout", wm_cycle_layout, true },
+    { "focus-next", wm_focus_on_next, false },
+    { "focus-previous", wm_focus_on_previous, false },
+    { "make-focused-special", wm_make_focused_special, false },
+    { "focus-monitor", wm_focus_monitor, true },
+    { "switch-to-workspace", wm_switch_to_workspace, true },
+    { "send-to-workspace", wm_send_to_workspace, true },
+    { "toggle-float", wm_toggle_float, false },
+};
+
+// Lets a brand new subscriber catch up, without having to ask for anything
+static void send_state(wm_t *wm, ipc_client_t *client)
+{
+    for (int i = 0; i < wm->total_monitors; i++)
+    {
+        ipc_reply(client, "event workspace %d %d\n", i, wm->monitors[i].active_workspace);
+
+        for (int j = 0; j < TOTAL_WORKSPACES; j++)
+            ipc_reply(client, "event layout %d %d %s\n",
+                    i, j, layout_name(workspace_on(wm, i, j)->layout));
+    }
+
+    client_t *focused = clients_get_focused(&get_workspace(wm)->clients);
+    ipc_reply(client, "event monitor %d\n", wm->active_monitor);
+    ipc_reply(client, "event gap %d\n", wm->gap);
+    ipc_reply(client, "event focus 0x%lx\n", focused ? focused->window : None);
+}
+
+// Every line is a command name, optionally followed by a space and its argument
+static void on_ipc_command(void *data, ipc_client_t *client, char *line)
+{
+    wm_t *wm = data;
+    char *argument = strchr(line, ' ');
+    if (argument)
+        *argument++ = '\0';
+
+    if (strcmp(line, "subscribe") == 0)
+    {
+        client->is_subscribed = true;
+        ipc_reply(client, "ok\n");
+        return send_state(wm, client);
+    }
+
+    // Lets benchmarks tell how much traffic each of their operations caused
+    if (strcmp(line, "stats") == 0)
+    {
+        const wm_stats_t *stats = &wm->stats;
+        return ipc_reply(client, "{\"requests\": %lu, \"configures_sent\": %lu, "
+                "\"layout_passes\": %lu, \"focus_changes\": %lu, \"batches\": %lu}\n",
+                NextRequest(wm->conn) - 1, stats->configures_sent, stats->layout_passes,
+                stats->focus_changes, stats->batches);
+    }
+
+    if (strcmp(line, "spawn") == 0 && argument)
+    {
+        const char *command[] = { "/bin/sh", "-c", argument, NULL };
+        wm_spawn(wm, (wm_arg_t) { .strs = command });
+        return ipc_reply(client, "ok\n");
+    }
+
+    for (int i = 0; i < ARRAY_LEN(wm_commands); i++)
+    {
+        const wm_command_t *command = &wm_commands[i];
+        if (strcmp(line, command->name) != 0)
+            continue;
+
+        wm_arg_t arg = { .amount = 0 };
+        if (command->has_amount)
+        {
+            char *end = NULL;
+            errno = 0;
+            arg.amount = argument ? strtol(argument, &end, 10) : 0;
+
+            if (!argument || end == argument || *end || errno)
+                return ipc_reply(client, "error %s expects a number\n", command->name);
+        }
 
-        XResizeWindow(wm->conn, c->window, new_w, new_h);
+        command->callback(wm, arg);
+        return ipc_reply(client, "ok\n");
     }
+
+    ipc_reply(client, "error unknown command\n");
 }
 
+// The X connection, the timerfd, the signalfd and a handful of IPC sockets
+#define TOTAL_WATCHED_FDS 16
+
 void wm_loop(wm_t *wm)
 {
+    struct epoll_event ready[TOTAL_WATCHED_FDS];
+
     while (wm->is_running)
     {
-        XEvent event;
-        XNextEvent(wm->conn, &event);
+        // Xlib might have already read some events off the connection,
+        // in which case we can't afford to go to sleep
+        const int timeout = XEventsQueued(wm->conn, QueuedAlready) ? 0 : -1;
+        const int total = epoll_wait(wm->epoll_fd, ready, TOTAL_WATCHED_FDS, timeout);
 
-        switch (event.type)
+        for (int i = 0; i < total; i++)
         {
-            case KeyPress: on_key_press(wm, &event.xkey); break;
-            case ButtonPress: on_button_press(wm, &event.xbutton); break;
-            case ButtonRelease: on_button_release(wm, &event.xbutton); break;
-
-            // Requests refer to actions that have not yet been executed
-            // It's the window manager's duty to either ignore or apply them
-            case ConfigureRequest: on_configure_request(wm, &event.xconfigurerequest); break;
-            case MapRequest: on_map_request(wm, &event.xmaprequest); break;
-
-            // Notifications will just inform the WM that a decision has been made
-            // We can't recall them, we just react to them
-            case UnmapNotify: on_unmap_notify(wm, &event.xunmap); break;
-            case EnterNotify: on_enter_notify(wm, &event.xcrossing); break;
-            case MotionNotify: on_motion_notify(wm, &event.xmotion); break;
+            if (ready[i].data.fd == wm->signal_fd)
+                handle_signals(wm);
+            else if (ready[i].data.fd == wm->timer_fd)
+            {
+                // Acknowledge the expiration, the deadlines tell us what's due
+                uint64_t expirations;
+                read(wm->timer_fd, &expirations, sizeof(expirations));
+            }
+            else if (ipc_owns(&wm->ipc, ready[i].data.fd))
+                ipc_handle(&wm->ipc, ready[i].data.fd, ready[i].events, on_ipc_command, wm);
         }
+
+        // Go through everything that has already arrived before waiting on
+        // any property replies, they will most likely be there by then
+        process_x_events(wm);
+        PROFILE_CALL(wm, PROFILE_TIMERS, run_due_timers(wm));
+        PROFILE_CALL(wm, PROFILE_ADOPT, adopt_pending_clients(wm));
+
+        // However many changes this batch made, the layout is computed only once
+        flush_visible_layouts(wm);
+        // Only the final focus of the batch ever reaches the server
+        flush_focus(wm);
+        flush_client_list(wm);
+        update_bars(wm);
+        wm->stats.batches++;
+
+        // Everything generated during this wake-up is sent out at once
+        XFlush(wm->conn);
+        ipc_flush(&wm->ipc);
     }
 }
 
-void wm_cleanup(wm_t *wm)
+static void print_latency(const char *name, const wm_latency_t *latency)
 {
+    // Avoid dividing by zero for operations that never took place
+    const unsigned long count = MAX(1, latency->count);
+
+    printf("\"%s\": {\"count\": %lu, \"avg_us\": %lld, \"max_us\": %lld, "
+           "\"requests_per_op\": %.2f}",
+           name, latency->count, latency->total_us / (long long) count,
+           latency->max_us, (double) latency->requests / count);
+}
+
+/*
+ * Dumps all counters as a single line of JSON, so that runs across builds
+ * can be compared by scripts and regressions don't go unnoticed
+ */
+static void print_stats(wm_t *wm)
+{
+    const wm_stats_t *stats = &wm->stats;
+
+    printf("{\"configures_sent\": %lu, \"configures_skipped\": %lu, ",
+            stats->configures_sent, stats->configures_skipped);
+    printf("\"drag_motions\": %lu, \"drag_commits\": %lu, ",
+            stats->drag_motions, stats->drag_commits);
+    printf("\"batches\": %lu, \"layout_passes\": %lu, \"focus_changes\": %lu, ",
+            stats->batches, stats->layout_passes, stats->focus_changes);
+    printf("\"configures_deferred\": %lu, \"sync_timeouts\": %lu, ",
+            stats->configures_deferred, stats->sync_timeouts);
+    printf("\"configure_requests_honored\": %lu, \"configure_requests_rewritten\": %lu, "
+            "\"configure_requests_dropped\": %lu, ", stats->configure_requests_honored,
+            stats->configure_requests_rewritten, stats->configure_requests_dropped);
+
+    print_latency("map", &stats->map_latency);
+    printf(", ");
+    print_latency("focus", &stats->focus_latency);
+    printf(", ");
+    print_latency("switch", &stats->switch_latency);
+    printf("}\n");
+}
+
+// Everything on our side of the connection, along with the connection itself
+static void disconnect(wm_t *wm)
+{
+    for (int i = 0; i < total_workspaces(wm); i++)
+        layout_cache_destroy(&wm->workspaces[i].layout_cache);
+
+    properties_disconnect(&wm->properties);
+    clients_index_destroy(&wm->index);
+    free(wm->key_entries);
+
+    ipc_close(&wm->ipc);
+    close(wm->epoll_fd);
+    close(wm->timer_fd);
+    close(wm->signal_fd);
     XCloseDisplay(wm->conn);
 }
 
+void wm_cleanup(wm_t *wm)
+{
+    print_stats(wm);
+
+    // None of those are handed over, the next instance creates its own
+    free_server_resources(wm);
+
+    /*
+     * On a restart, the connection is left for the exec to close (it's
+     * close-on-exec). Until then the clients are still ours, and if the exec
+     * fails wm_cancel_restart() can give them back
+     */
+    if (wm->is_restarting)
+    {
+        hand_over(wm);
+        XSync(wm->conn, false);
+        return;
+    }
+
+    release_clients(wm);
+    disconnect(wm);
+}
+
+/*
+ * The exec failed, so no instance is left to adopt the clients. Windows on
+ * hidden workspaces would otherwise stay in containers that nobody maps
+ */
+void wm_cancel_restart(wm_t *wm)
+{
+    wm->is_restarting = false;
+
+    // The containers go away along with the connection again
+    XSetCloseDownMode(wm->conn, DestroyAll);
+    XDeleteProperty(wm->conn, wm->root, wm->atoms[ATOM_WM_RESTART_STATE]);
+
+    release_clients(wm);
+    disconnect(wm);
+}
+
 void wm_quit(wm_t *wm, const wm_arg_t arg)
 {
     wm->is_running = false;
 }
 
-// Create a new window manager child process
+void wm_restart(wm_t *wm, const wm_arg_t arg)
+{
+    wm->is_running = false;
+    wm->is_restarting = true;
+}
+
+// Launch a program, without ever duplicating the window manager itself
 void wm_spawn(wm_t *wm, const wm_arg_t arg)
 {
-    if (fork() == 0)
-    {
-        // By convention, the first argument should be the path to the invoked command
-        execvp((char*) arg.strs[0], (char**) arg.strs);
+    /*
+     * Unlike fork(), posix_spawn() does not copy our address space (glibc uses
+     * vfork semantics), so its cost does not grow with our memory, and none of
+     * our code or Xlib's ever runs inside the child. The signal mask is
+     * inherited, and the child expects to receive all of them
+     */
+    sigset_t mask;
+    sigemptyset(&mask);
 
-        // If we've reached this point, it means that the call failed!
-        // Normally, the program would have been replaced by the new process
-        log_fatal("failed to replace process image in fork()");
-    }
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigmask(&attributes, &mask);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+    // By convention, the first argument should be the path to the invoked command
+    pid_t pid;
+    int error = posix_spawnp(&pid, arg.strs[0], NULL, &attributes, (char**) arg.strs, environ);
+    if (error)
+        log_error("failed to spawn %s: %s", arg.strs[0], strerror(error));
+
+    posix_spawnattr_destroy(&attributes);
 }
 
 void wm_adjust_special_width(wm_t *wm, const wm_arg_t arg)
@@ -654,27 +2704,52 @@ void wm_adjust_special_width(wm_t *wm, const wm_arg_t arg)
     const int padding = 40;
 
     int new_width = space->special_width + arg.amount;
-    if (new_width < padding || new_width > wm->width - 2 * wm->gap - padding) return;
+    if (new_width < padding || new_width > get_monitor(wm)->width - 2 * wm->gap - padding) return;
 
     space->special_width = new_width;
-    tile(wm, space);
+    mark_dirty(space);
 }
 
 void wm_reset_special_width(wm_t *wm, const wm_arg_t arg)
 {
     workspace_t *space = get_workspace(wm);
+    const int width = get_monitor(wm)->width;
 
-    if (space->special_width != wm->width / 2)
+    if (space->special_width != width / 2)
     {
-        space->special_width = wm->width / 2;
-        tile(wm, space);
+        space->special_width = width / 2;
+        mark_dirty(space);
     }
 }
 
 void wm_adjust_gap(wm_t *wm, const wm_arg_t arg)
 {
     wm->gap = MAX(0, wm->gap + arg.amount);
-    tile(wm, get_workspace(wm));
+    ipc_broadcast(&wm->ipc, "event gap %d\n", wm->gap);
+
+    // The gap is shared, hidden workspaces will catch up once they are visited
+    for (int i = 0; i < total_workspaces(wm); i++)
+        mark_dirty(&wm->workspaces[i]);
+}
+
+void wm_cycle_layout(wm_t *wm, const wm_arg_t arg)
+{
+    workspace_t *space = get_workspace(wm);
+    const int layout = ((space->layout + arg.amount) % TOTAL_LAYOUTS + TOTAL_LAYOUTS) % TOTAL_LAYOUTS;
+
+    space->layout = layout;
+    mark_dirty(space);
+    ipc_broadcast(&wm->ipc, "event layout %d %d %s\n", wm->active_monitor,
+            wm->monitors[wm->active_monitor].active_workspace, layout_name(layout));
+
+    // Stacking the tiled windows on top of each other hides all but the last one
+    client_t *focused = clients_get_focused(&space->clients);
+    if (layout == LAYOUT_MONOCLE && focused && !focused->is_floating)
+    {
+        unsigned long first_request = begin_ignoring_errors(wm);
+        XRaiseWindow(wm->conn, focused->window);
+        end_ignoring_errors(wm, first_request);
+    }
 }
 
 // This is once again inspired by dwm and vim
@@ -685,8 +2760,8 @@ void wm_focus_on_next(wm_t *wm, const wm_arg_t arg)
 
     if (space->clients.length > 1)
     {
-        // Wrap around if you've gone past the limit
-        client_t *next = (f->next ? f->next : space->clients.head);
+        // Wrap around if you've gone past the limit, or start over with no focus
+        client_t *next = (f && f->next ? f->next : space->clients.head);
         focus_client(wm, space, next);
     }
 }
@@ -698,7 +2773,7 @@ void wm_focus_on_previous(wm_t *wm, const wm_arg_t arg)
 
     if (space->clients.length > 1)
     {
-        client_t *next = (f->previous ? f->previous : space->clients.tail);
+        client_t *next = (f && f->previous ? f->previous : space->clients.tail);
         focus_client(wm, space, next);
     }
 }
@@ -714,41 +2789,63 @@ void wm_make_focused_special(wm_t *wm, const wm_arg_t arg)
         clients_remove_client(&space->clients, f);
         clients_insert(&space->clients, f);
 
-        tile(wm, space);
+        mark_dirty(space);
     }
 }
 
+void wm_focus_monitor(wm_t *wm, const wm_arg_t arg)
+{
+    const int total = wm->total_monitors;
+    focus_monitor(wm, ((wm->active_monitor + arg.amount) % total + total) % total);
+}
+
+// Only the active monitor is affected, the rest keep showing their own workspaces
 void wm_switch_to_workspace(wm_t *wm, const wm_arg_t arg)
 {
-    if (wm->active_workspace == arg.amount) return;
-    workspace_t *space = get_workspace(wm);
+    monitor_t *monitor = get_monitor(wm);
+    // The amount might come from the IPC socket, so it can't be trusted
+    if (arg.amount < 0 || arg.amount >= TOTAL_WORKSPACES) return;
+    if (monitor->active_workspace == arg.amount) return;
 
-    // Unmap all clients in the current workspace, making them temporarily invisible
-    for (client_t *c = space->clients.head; c; c = c->next)
-    {
-        XUnmapWindow(wm->conn, c->window);
-    }
+    const long long start = monotonic_time_us();
+    const unsigned long first_request = NextRequest(wm->conn);
 
-    wm->active_workspace = arg.amount;
+    // Map the new container first, so that the root never shows through
+    workspace_t *previous = get_workspace(wm);
+    workspace_t *space = workspace_on(wm, wm->active_monitor, arg.amount);
+
+    // Catch up on any layout changes that happened while it was hidden
+    flush_layout(wm, space);
+
+    // Hiding the container hides all of its clients, no matter how many
+    XMapRaised(wm->conn, space->container);
+    XUnmapWindow(wm->conn, previous->container);
+    // The container would cover the bar otherwise
+    if (bar_is_open(&wm->bars[wm->active_monitor]))
+        XRaiseWindow(wm->conn, wm->bars[wm->active_monitor].window);
+
+    monitor->active_workspace = arg.amount;
     // Prevent expected enter notify events from changing focus
     wm->has_moved_cursor = false;
-    space = get_workspace(wm);
 
-    for (client_t *c = space->clients.head; c; c = c->next)
-    {
-        XMapWindow(wm->conn, c->window);
-    }
+    // Focus back on the window that was active last time we left. Unmapping
+    // the previous container reverted the input focus, even if the batch
+    // ends up right back on the same window
+    mark_focus_dirty(wm);
+    wm->is_focus_lost = true;
+    publish_current_desktop(wm);
+    ipc_broadcast(&wm->ipc, "event workspace %d %d\n", wm->active_monitor, arg.amount);
 
-    // Focus back on the window that was active last time we left
-    visually_reflect_focus(wm, space);
+    record_latency(wm, &wm->stats.switch_latency, start, first_request);
 }
 
 // Send the application currently in focus to the provided workspace
 void wm_send_to_workspace(wm_t *wm, const wm_arg_t arg)
 {
-    if (wm->active_workspace == arg.amount) return;
+    if (arg.amount < 0 || arg.amount >= TOTAL_WORKSPACES) return;
+    if (get_monitor(wm)->active_workspace == arg.amount) return;
     workspace_t *source = get_workspace(wm);
-    workspace_t *target = &wm->workspaces[arg.amount];
+    workspace_t *target = workspace_on(wm, wm->active_monitor, arg.amount);
 
     client_t *client = clients_get_focused(&source->clients);
     // If no client is currently focused, ignore
@@ -763,16 +2860,23 @@ void wm_send_to_workspace(wm_t *wm, const wm_arg_t arg)
         
     // The window is gone, focus on the next one on the stack
     clients_remove_focus(&source->clients, client);
-    visually_reflect_focus(wm, source);
-
-    XUnmapWindow(wm->conn, client->window);
-    // WARNING: We don't want to focus_client since the window is currently unmapped
+    mark_focus_dirty(wm);
+
+    // The server unmaps the window before moving it to the hidden container
+    // It might be gone already, DestroyNotify then finds it on the target
+    unsigned long first_request = begin_ignoring_errors(wm);
+    XReparentWindow(wm->conn, client->window, target->container, client->x, client->y);
+    publish_client_desktop(wm, client);
+    end_ignoring_errors(wm, first_request);
+    client->ignored_unmaps++;
+    // WARNING: We don't want to focus_client since the window is currently invisible
     // If you try to do this, X11 will explode
-    visually_unfocus_focused(wm, target);
     clients_push_focus(&target->clients, client);
 
-    tile(wm, source);
-    tile(wm, target);
+    mark_dirty(source);
+    mark_dirty(target);
+    ipc_broadcast(&wm->ipc, "event move 0x%lx %d %d\n", client->window,
+            wm->active_monitor, arg.amount);
 }
 
 void wm_toggle_float(wm_t *wm, const wm_arg_t arg)
@@ -783,6 +2887,7 @@ void wm_toggle_float(wm_t *wm, const wm_arg_t arg)
     if (target)
     {
         target->is_floating = !target->is_floating;
-        tile(wm, s);
+        mark_dirty(s);
+        ipc_broadcast(&wm->ipc, "event float 0x%lx %d\n", target->window, target->is_floating);
     }
 }
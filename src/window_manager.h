@@ -4,8 +4,15 @@
 #include <stdbool.h>
 #include <X11/Xutil.h>
 #include "clients.h"
+#include "properties.h"
+#include "profile.h"
+#include "ipc.h"
+#include "layouts.h"
+#include "bar.h"
 
 #define TOTAL_WORKSPACES 9
+// Any outputs beyond this are simply left alone
+#define MAX_MONITORS 8
 
 // Creating an enum-array to store non-predefined atom values
 // Server queries are expensive, so we should cache them!
@@ -17,28 +24,158 @@ typedef enum
     ATOM_NET_ACTIVE_WINDOW,
     ATOM_WM_WINDOW_TYPE,
     ATOM_WM_DIALOG_TYPE,
+    // EWMH root and window properties, so that panels never have to poll
+    ATOM_NET_SUPPORTING_WM_CHECK,
+    ATOM_NET_WM_NAME,
+    ATOM_UTF8_STRING,
+    ATOM_NET_SUPPORTED,
+    ATOM_NET_CLIENT_LIST,
+    ATOM_NET_NUMBER_OF_DESKTOPS,
+    ATOM_NET_CURRENT_DESKTOP,
+    ATOM_NET_WM_DESKTOP,
+    ATOM_NET_WM_SYNC_REQUEST,
+    ATOM_NET_WM_SYNC_REQUEST_COUNTER,
+    // Where wm_restart() leaves our state for the next instance
+    ATOM_WM_RESTART_STATE,
     TOTAL_ATOMS,
 } wm_atom_e;
 
 typedef struct
 {
     client_list_t clients;
+    // All clients are reparented into this window, so that the whole
+    // workspace can be hidden or shown using a single request
+    Window container;
 
     // The width of the special window, initially set to half the screen width
     int special_width;
+    layout_e layout;
+    // The rectangles of the last layout pass, reused until the clients change
+    layout_cache_t layout_cache;
+    // Set when the layout has to be re-calculated, check out mark_dirty()
+    bool is_dirty;
+    // Index of the monitor that the workspace belongs to
+    int monitor;
 } workspace_t;
 
+typedef struct
+{
+    // Position and dimensions within the root window, in pixels
+    int x, y, width, height;
+    // Index among the workspaces of this monitor, check out workspace_on()
+    int active_workspace;
+} monitor_t;
+
+// Deadlines that the main loop should wake up for, all sharing a single timerfd
+typedef enum
+{
+    TIMER_DRAG,
+    // The earliest client that might never acknowledge its sync request
+    TIMER_SYNC,
+    TOTAL_TIMERS,
+} wm_timer_e;
+
+// Keycodes are 8-bit, as defined by the core protocol
+#define TOTAL_KEYCODES 256
+
+// Entry of the key dispatch table, chaining all bindings that share a keycode
+typedef struct wm_key_entry_t
+{
+    KeyCode keycode;
+    // Without any lock modifiers, check out clean_modifiers()
+    unsigned int modifiers;
+    // Index into wm_bindings, or -1 for the kill client key
+    int binding;
+
+    struct wm_key_entry_t *next;
+} wm_key_entry_t;
+
+// Wall time and X requests spent on a single kind of operation
+typedef struct
+{
+    unsigned long count;
+    long long total_us, max_us;
+    unsigned long requests;
+} wm_latency_t;
+
+// Counters that help us keep an eye on the amount of traffic we generate
+typedef struct
+{
+    unsigned long configures_sent;
+    unsigned long configures_skipped;
+    // Held back while the client was still repainting, and then replaced
+    unsigned long configures_deferred;
+    // Clients that never acknowledged a sync request in time
+    unsigned long sync_timeouts;
+    // ConfigureRequests applied as asked, adjusted by our policy, or left out
+    // because nothing would have changed
+    unsigned long configure_requests_honored;
+    unsigned long configure_requests_rewritten;
+    unsigned long configure_requests_dropped;
+
+    // Motion events received while dragging, versus geometry commits
+    unsigned long drag_motions;
+    unsigned long drag_commits;
+
+    // From the MapRequest until the window is mapped in its final position
+    wm_latency_t map_latency;
+    wm_latency_t focus_latency;
+    // Should stay constant, no matter how many windows the workspaces hold
+    wm_latency_t switch_latency;
+
+    // Wake-ups of the main loop, versus actual layout passes
+    unsigned long batches;
+    unsigned long layout_passes;
+    // Focus stack changes, versus focus commits (focus_latency.count)
+    unsigned long focus_changes;
+} wm_stats_t;
+
+// Borders and the bar, see try_load_named_color()
+#define MAX_ALLOCATED_COLORS 8
+
 typedef struct
 {
     Display *conn;
     Colormap colormap;
+    Cursor cursor;
+    // Proves to EWMH clients that a compliant WM is running, see publish_wm_check()
+    Window check_window;
+
+    // The main loop sleeps on these, along with the X connection itself
+    int epoll_fd, timer_fd, signal_fd;
+    // Absolute deadlines in microseconds (monotonic_time_us), 0 when disarmed
+    long long timers[TOTAL_TIMERS];
+    // Scripts and status bars talk to us through this, check out ipc.h
+    ipc_server_t ipc;
 
     int gap;
-    int active_workspace;
-    workspace_t workspaces[TOTAL_WORKSPACES];
+    monitor_t monitors[MAX_MONITORS];
+    int total_monitors, active_monitor;
+    // Every monitor owns TOTAL_WORKSPACES consecutive workspaces
+    workspace_t workspaces[MAX_MONITORS * TOTAL_WORKSPACES];
+    // Set when _NET_CLIENT_LIST has to be rewritten, check out flush_client_list()
+    bool is_client_list_dirty;
+    // The client that the server last saw focused, check out flush_focus()
+    client_t *committed_focus;
+    bool is_focus_dirty;
+    // The server might have moved the input focus on its own
+    bool is_focus_lost;
 
-    // Dimensions of the entire monitor in pixels
-    int width, height;
+    // One per monitor, check out bar.h. The height is 0 when there are no bars
+    bar_theme_t bar_theme;
+    bar_t bars[MAX_MONITORS];
+    int bar_height;
+    // The name of the root window, NUL padded
+    char status[MAX_STATUS_LENGTH];
+#ifdef WM_XRANDR
+    // RandR events are numbered relative to this
+    int randr_event_base;
+#endif
+    // Resizes are paced through _NET_WM_SYNC_REQUEST if the server has XSync
+    bool has_sync;
+    int sync_event_base;
+    // Shared by the client lists of all workspaces
+    client_index_t index;
 
     int drag_cursor_x, drag_cursor_y;
     // Storing information about the window currently being dragged or resized
@@ -46,21 +183,47 @@ typedef struct
     unsigned int drag_window_w, drag_window_h;
     // Will be equal to NULL when no client is being dragged
     client_t *dragged_client;
+    // The latest geometry requested by the pointer, which might not be applied yet
+    int drag_target_x, drag_target_y, drag_target_w, drag_target_h;
+    bool has_pending_drag;
+    long long last_drag_commit;
+
+    // Windows that asked to be mapped, waiting on their properties to arrive
+    property_queue_t properties;
+
+    // Resolves a key press to its binding without any keysym translation
+    // Rebuilt whenever the keyboard mapping changes
+    wm_key_entry_t *key_table[TOTAL_KEYCODES];
+    wm_key_entry_t *key_entries;
+    // The modifier that NumLock happens to be mapped to, if any
+    unsigned int numlock_mask;
 
     Atom atoms[TOTAL_ATOMS];
     // We're only dealing with simple, single-monitor setups (as of now)
     Window root;
     bool has_moved_cursor;
     bool is_running;
+    // Set by wm_restart(), main() will execute the binary again after cleaning up
+    bool is_restarting;
+
+    wm_stats_t stats;
+#ifdef WM_PROFILE
+    profiler_t profiler;
+#endif
 
     // Cache color indices
     XColor border_color;
     XColor focused_border_color;
+    // Every cell we hold in the colormap, released by free_server_resources()
+    unsigned long allocated_pixels[MAX_ALLOCATED_COLORS];
+    int total_allocated_pixels;
 } wm_t;
 
 void wm_setup(wm_t *wm);
 void wm_loop(wm_t *wm);
 void wm_cleanup(wm_t *wm);
+// Only after a failed exec, once wm_cleanup() has handed everything over
+void wm_cancel_restart(wm_t *wm);
 
 /*
  * This design is inspired by dwm.
@@ -79,8 +242,6 @@ typedef struct
     KeySym keysym;
 } wm_key_t;
 
-bool are_keys_equal(wm_key_t a, wm_key_t b);
-
 typedef struct
 {
     wm_key_t key;
@@ -95,16 +256,22 @@ typedef struct
  */
 void wm_spawn(wm_t *wm, const wm_arg_t arg);
 void wm_quit(wm_t *wm, const wm_arg_t arg);
+// Clients keep their workspaces, position, focus order and floating state
+void wm_restart(wm_t *wm, const wm_arg_t arg);
 
 // The argument represents dx, min and max bound checking will be applied
 void wm_adjust_special_width(wm_t *wm, const wm_arg_t arg);
 void wm_reset_special_width(wm_t *wm, const wm_arg_t arg);
 void wm_adjust_gap(wm_t *wm, const wm_arg_t arg);
+// The argument is added to the layout of the active workspace, wrapping around
+void wm_cycle_layout(wm_t *wm, const wm_arg_t arg);
 
 void wm_toggle_float(wm_t *wm, const wm_arg_t arg);
 void wm_focus_on_next(wm_t *wm, const wm_arg_t arg);
 void wm_focus_on_previous(wm_t *wm, const wm_arg_t arg);
 void wm_make_focused_special(wm_t *wm, const wm_arg_t arg);
+// The argument is added to the index of the active monitor, wrapping around
+void wm_focus_monitor(wm_t *wm, const wm_arg_t arg);
 void wm_switch_to_workspace(wm_t *wm, const wm_arg_t arg);
 void wm_send_to_workspace(wm_t *wm, const wm_arg_t arg);
 
@@ -0,0 +1,67 @@
+#!/bin/sh
+# Runs the WM on a headless Xvfb server and sweeps xbench over a growing
+# number of windows. Prints one line of JSON per size, followed by the
+# counters that the WM itself dumps on exit. Usually run through `make bench`
+#
+#   tests/bench.sh <wm binary> <xbench binary> [sizes...]
+
+set -e
+
+WM=$1
+XBENCH=$2
+shift 2
+SIZES=${*:-"1 2 5 10 20 50 100 200 500"}
+
+# A display number that is unlikely to be taken, override it if it is
+DISPLAY_NUMBER=${BENCH_DISPLAY:-:97}
+
+command -v Xvfb >/dev/null || { echo "bench: Xvfb is required" >&2; exit 1; }
+
+# The WM only opens its socket inside XDG_RUNTIME_DIR, give it a private one
+RUNTIME_DIR=$(mktemp -d)
+chmod 700 "$RUNTIME_DIR"
+
+cleanup() {
+    [ -n "$WM_PID" ] && kill "$WM_PID" 2>/dev/null
+    [ -n "$XVFB_PID" ] && kill "$XVFB_PID" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$RUNTIME_DIR"
+}
+trap cleanup EXIT INT TERM
+
+Xvfb "$DISPLAY_NUMBER" -screen 0 1280x800x24 -nolisten tcp >/dev/null 2>&1 &
+XVFB_PID=$!
+export DISPLAY=$DISPLAY_NUMBER
+
+# Xvfb does not tell us when it's ready, so wait for its socket to show up
+SERVER_SOCKET=/tmp/.X11-unix/X${DISPLAY_NUMBER#:}
+for _ in $(seq 50); do
+    [ -S "$SERVER_SOCKET" ] && break
+    sleep 0.1
+done
+
+XDG_RUNTIME_DIR=$RUNTIME_DIR "$WM" >"$RUNTIME_DIR/wm.log" 2>&1 &
+WM_PID=$!
+
+SOCKET=$RUNTIME_DIR/testwm$DISPLAY_NUMBER.sock
+for _ in $(seq 50); do
+    [ -S "$SOCKET" ] && break
+    sleep 0.1
+done
+[ -S "$SOCKET" ] || { echo "bench: the WM did not start" >&2; cat "$RUNTIME_DIR/wm.log" >&2; exit 1; }
+
+# A WM that died halfway through leaves xbench timing out, its log says why
+for size in $SIZES; do
+    if ! "$XBENCH" "$SOCKET" "$size"; then
+        echo "bench: failed at $size windows" >&2
+        kill -0 "$WM_PID" 2>/dev/null || echo "bench: the WM exited" >&2
+        cat "$RUNTIME_DIR/wm.log" >&2
+        exit 1
+    fi
+done
+
+# The WM prints its own counters as JSON on its way out
+kill "$WM_PID"
+wait "$WM_PID" 2>/dev/null || true
+WM_PID=
+grep '^{' "$RUNTIME_DIR/wm.log" || true
@@ -0,0 +1,250 @@
+/*
+ * Times every operation of clients.c for growing numbers of clients, without
+ * an X server. Each size is printed as a line of JSON with the average cost
+ * of a single operation in nanoseconds, so that runs across builds can be
+ * compared by scripts. Run through `make bench_clients`.
+ *
+ * The same operations are also run against the original design, which is
+ * kept below for reference: a malloc per client, a malloc per focus entry
+ * and linear searches for both lookups and focus removal.
+ */
+#include "../src/clients.h"
+#include "../src/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const int sizes[] = { 10, 100, 1000, 10000, 100000 };
+// The original design is quadratic, anything larger takes minutes
+#define MAX_LEGACY_CLIENTS 10000
+
+static long long now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static unsigned long long rng_state = 0x5eed;
+
+static unsigned int next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (unsigned int) (rng_state >> 32);
+}
+
+// Fisher-Yates, so that lookups and removals don't just follow insertion order
+// Shuffles arrays of pointers, to either kind of client
+static void shuffle(void *array, int total)
+{
+    void **items = array;
+    for (int i = total - 1; i > 0; i--)
+    {
+        const int j = next_random() % (i + 1);
+        void *temp = items[i];
+        items[i] = items[j];
+        items[j] = temp;
+    }
+}
+
+// Keeps the compiler from dropping lookups whose result is never used
+static volatile unsigned long sink;
+
+// Average cost of each operation, in nanoseconds
+typedef struct
+{
+    double insert, find, push_focus, resurface_focus, destroy;
+} timings_t;
+
+static void print_timings(const char *implementation, int total, const timings_t *t)
+{
+    printf("{\"implementation\": \"%s\", \"clients\": %d, \"insert_ns\": %.1f, "
+           "\"find_ns\": %.1f, \"push_focus_ns\": %.1f, \"resurface_focus_ns\": %.1f, "
+           "\"destroy_ns\": %.1f}\n", implementation, total, t->insert, t->find,
+           t->push_focus, t->resurface_focus, t->destroy);
+}
+
+static void bench_pool(int total)
+{
+    client_index_t index;
+    client_list_t list;
+    client_t **clients = malloc(total * sizeof(client_t*));
+    if (!clients)
+        exit(EXIT_FAILURE);
+
+    clients_index_initialize(&index);
+    clients_initialize(&list, &index);
+
+    // Window IDs come in runs, just like the ones handed out by the server
+    long long start = now_ns();
+    for (int i = 0; i < total; i++)
+    {
+        clients[i] = create_client(0x400000 + i);
+        clients_insert(&list, clients[i]);
+    }
+    timings_t t;
+    t.insert = (double) (now_ns() - start) / total;
+
+    shuffle(clients, total);
+    start = now_ns();
+    for (int i = 0; i < total; i++)
+        sink += (unsigned long) clients_find_by_window(&index, clients[i]->window);
+    t.find = (double) (now_ns() - start) / total;
+
+    // The first push of every client creates its entry, the second one resurfaces it
+    start = now_ns();
+    for (int i = 0; i < total; i++)
+        clients_push_focus(&list, clients[i]);
+    t.push_focus = (double) (now_ns() - start) / total;
+
+    shuffle(clients, total);
+    start = now_ns();
+    for (int i = 0; i < total; i++)
+        clients_push_focus(&list, clients[i]);
+    t.resurface_focus = (double) (now_ns() - start) / total;
+
+    shuffle(clients, total);
+    start = now_ns();
+    for (int i = 0; i < total; i++)
+        clients_destroy_client(&list, clients[i]);
+    t.destroy = (double) (now_ns() - start) / total;
+
+    print_timings("pool", total, &t);
+
+    clients_index_destroy(&index);
+    free(clients);
+}
+
+typedef struct legacy_client_t
+{
+    Window window;
+    struct legacy_client_t *next;
+    struct legacy_client_t *previous;
+    // Stands in for the rest of the fields, so that malloc sees the same sizes
+    char payload[sizeof(client_t) - sizeof(Window) - 2 * sizeof(void*)];
+} legacy_client_t;
+
+typedef struct legacy_focus_t
+{
+    legacy_client_t *client;
+    struct legacy_focus_t *next;
+} legacy_focus_t;
+
+typedef struct
+{
+    legacy_client_t *head;
+    legacy_focus_t *focus_stack;
+} legacy_list_t;
+
+static legacy_client_t* legacy_find(const legacy_list_t *list, Window window)
+{
+    for (legacy_client_t *c = list->head; c; c = c->next)
+        if (c->window == window)
+            return c;
+
+    return NULL;
+}
+
+static legacy_focus_t* legacy_remove_from_focus(legacy_list_t *list, legacy_client_t *c)
+{
+    legacy_focus_t **link = &list->focus_stack;
+    while (*link && (*link)->client != c)
+        link = &(*link)->next;
+
+    legacy_focus_t *f = *link;
+    if (f)
+        *link = f->next;
+
+    return f;
+}
+
+static void legacy_push_focus(legacy_list_t *list, legacy_client_t *c)
+{
+    legacy_focus_t *f = legacy_remove_from_focus(list, c);
+    if (!f)
+    {
+        f = malloc(sizeof(legacy_focus_t));
+        if (!f)
+            exit(EXIT_FAILURE);
+        f->client = c;
+    }
+
+    f->next = list->focus_stack;
+    list->focus_stack = f;
+}
+
+static void bench_legacy(int total)
+{
+    legacy_list_t list = { NULL, NULL };
+    legacy_client_t **clients = malloc(total * sizeof(legacy_client_t*));
+    if (!clients)
+        exit(EXIT_FAILURE);
+
+    timings_t t;
+    long long start = now_ns();
+    for (int i = 0; i < total; i++)
+    {
+        legacy_client_t *c = malloc(sizeof(legacy_client_t));
+        if (!c)
+            exit(EXIT_FAILURE);
+
+        c->window = 0x400000 + i;
+        c->previous = NULL;
+        c->next = list.head;
+        if (list.head)
+            list.head->previous = c;
+        list.head = clients[i] = c;
+    }
+    t.insert = (double) (now_ns() - start) / total;
+
+    shuffle(clients, total);
+    start = now_ns();
+    for (int i = 0; i < total; i++)
+        sink += (unsigned long) legacy_find(&list, clients[i]->window);
+    t.find = (double) (now_ns() - start) / total;
+
+    start = now_ns();
+    for (int i = 0; i < total; i++)
+        legacy_push_focus(&list, clients[i]);
+    t.push_focus = (double) (now_ns() - start) / total;
+
+    shuffle(clients, total);
+    start = now_ns();
+    for (int i = 0; i < total; i++)
+        legacy_push_focus(&list, clients[i]);
+    t.resurface_focus = (double) (now_ns() - start) / total;
+
+    shuffle(clients, total);
+    start = now_ns();
+    for (int i = 0; i < total; i++)
+    {
+        legacy_client_t *c = clients[i];
+        if (c->previous)
+            c->previous->next = c->next;
+        else
+            list.head = c->next;
+        if (c->next)
+            c->next->previous = c->previous;
+
+        free(legacy_remove_from_focus(&list, c));
+        free(c);
+    }
+    t.destroy = (double) (now_ns() - start) / total;
+
+    print_timings("malloc", total, &t);
+    free(clients);
+}
+
+int main(void)
+{
+    for (unsigned int i = 0; i < ARRAY_LEN(sizes); i++)
+    {
+        bench_pool(sizes[i]);
+        if (sizes[i] <= MAX_LEGACY_CLIENTS)
+            bench_legacy(sizes[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
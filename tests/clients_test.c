@@ -0,0 +1,358 @@
+/*
+ * Checks clients.c against a plain reference model, without an X server.
+ * Every operation is applied to both, and the lists, focus stacks and the
+ * shared window index are compared after each step. Run through `make test`,
+ * an optional argument overrides the random seed.
+ */
+#include "../src/clients.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOTAL_LISTS 3
+#define MAX_MODEL_CLIENTS 512
+#define TOTAL_STEPS 50000
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+        return; \
+    } \
+} while (0)
+
+// Windows in list order and focus order, most recent first
+typedef struct
+{
+    Window windows[MAX_MODEL_CLIENTS];
+    int length;
+    Window focus[MAX_MODEL_CLIENTS];
+    int focus_length;
+} model_list_t;
+
+static unsigned long long rng_state;
+
+static unsigned int next_random(void)
+{
+    // xorshift64, good enough and the same on every libc
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (unsigned int) (rng_state >> 32);
+}
+
+static void model_remove_at(Window *array, int *length, int i)
+{
+    memmove(&array[i], &array[i + 1], (*length - i - 1) * sizeof(Window));
+    (*length)--;
+}
+
+static int model_find(const Window *array, int length, Window window)
+{
+    for (int i = 0; i < length; i++)
+        if (array[i] == window)
+            return i;
+
+    return -1;
+}
+
+static void model_insert(model_list_t *m, Window window)
+{
+    memmove(&m->windows[1], &m->windows[0], m->length * sizeof(Window));
+    m->windows[0] = window;
+    m->length++;
+}
+
+static void model_remove_focus(model_list_t *m, Window window)
+{
+    int i = model_find(m->focus, m->focus_length, window);
+    if (i != -1)
+        model_remove_at(m->focus, &m->focus_length, i);
+}
+
+static void model_push_focus(model_list_t *m, Window window)
+{
+    model_remove_focus(m, window);
+    memmove(&m->focus[1], &m->focus[0], m->focus_length * sizeof(Window));
+    m->focus[0] = window;
+    m->focus_length++;
+}
+
+static void check_list(const client_list_t *list, const model_list_t *m)
+{
+    CHECK(list->length == m->length);
+
+    // Walking forwards and then backwards catches broken links in either direction
+    int i = 0;
+    const client_t *last = NULL;
+    for (const client_t *c = list->head; c; c = c->next, i++)
+    {
+        CHECK(i < m->length && c->window == m->windows[i]);
+        CHECK(c->previous == last);
+        CHECK(c->list == list);
+        last = c;
+    }
+    CHECK(i == m->length);
+    CHECK(list->tail == last);
+
+    i = 0;
+    last = NULL;
+    for (const client_t *c = list->focus_stack; c; c = c->focus_next, i++)
+    {
+        CHECK(i < m->focus_length && c->window == m->focus[i]);
+        CHECK(c->focus_previous == last);
+        last = c;
+    }
+    CHECK(i == m->focus_length);
+
+    const client_t *focused = clients_get_focused((client_list_t*) list);
+    CHECK(m->focus_length ? focused && focused->window == m->focus[0] : !focused);
+}
+
+static void check_all(client_list_t *lists, const model_list_t *models,
+                      const client_index_t *index, Window next_window)
+{
+    int total = 0;
+    for (int l = 0; l < TOTAL_LISTS; l++)
+    {
+        check_list(&lists[l], &models[l]);
+        total += models[l].length;
+
+        for (int i = 0; i < models[l].length; i++)
+        {
+            const client_t *c = clients_find_by_window(index, models[l].windows[i]);
+            CHECK(c && c->window == models[l].windows[i] && c->list == &lists[l]);
+        }
+    }
+
+    CHECK(index->length == total);
+    // The next window has never been created, so it must not be found
+    CHECK(!clients_find_by_window(index, next_window));
+}
+
+// Picks a random client out of a random list, NULL if that list is empty
+static client_t* pick_client(client_list_t *lists, model_list_t *models, int *l)
+{
+    *l = next_random() % TOTAL_LISTS;
+    if (models[*l].length == 0)
+        return NULL;
+
+    Window window = models[*l].windows[next_random() % models[*l].length];
+    return clients_find_by_window(lists[*l].index, window);
+}
+
+static void test_randomized(unsigned long long seed)
+{
+    client_index_t index;
+    client_list_t lists[TOTAL_LISTS];
+    model_list_t models[TOTAL_LISTS];
+
+    clients_index_initialize(&index);
+    for (int l = 0; l < TOTAL_LISTS; l++)
+    {
+        clients_initialize(&lists[l], &index);
+        models[l].length = models[l].focus_length = 0;
+    }
+
+    rng_state = seed;
+    Window next_window = 1;
+    int step;
+
+    for (step = 0; step < TOTAL_STEPS && !failures; step++)
+    {
+        int l;
+        client_t *c;
+        const unsigned int operation = next_random() % 6;
+
+        switch (operation)
+        {
+            // Create, weighted so that the lists keep growing and shrinking
+            case 0:
+            case 1:
+                l = next_random() % TOTAL_LISTS;
+                if (models[l].length == MAX_MODEL_CLIENTS)
+                    break;
+
+                // Window IDs come in runs, just like the ones handed out by the server
+                c = create_client(next_window);
+                clients_insert(&lists[l], c);
+                model_insert(&models[l], next_window++);
+                break;
+
+            case 2:
+                if (!(c = pick_client(lists, models, &l)))
+                    break;
+
+                model_remove_at(models[l].windows, &models[l].length,
+                        model_find(models[l].windows, models[l].length, c->window));
+                model_remove_focus(&models[l], c->window);
+                clients_destroy_client(&lists[l], c);
+                break;
+
+            case 3:
+                if (!(c = pick_client(lists, models, &l)))
+                    break;
+
+                model_push_focus(&models[l], c->window);
+                clients_push_focus(&lists[l], c);
+                break;
+
+            case 4:
+                if (!(c = pick_client(lists, models, &l)))
+                    break;
+
+                model_remove_focus(&models[l], c->window);
+                clients_remove_focus(&lists[l], c);
+                break;
+
+            // Move to another list, or back to the head of the same one
+            case 5:
+            {
+                if (!(c = pick_client(lists, models, &l)))
+                    break;
+
+                const int target = next_random() % TOTAL_LISTS;
+                if (models[target].length == MAX_MODEL_CLIENTS && target != l)
+                    break;
+
+                const Window window = c->window;
+                model_remove_at(models[l].windows, &models[l].length,
+                        model_find(models[l].windows, models[l].length, window));
+
+                // A client only keeps its focus entry within its own list
+                if (target != l)
+                {
+                    model_remove_focus(&models[l], window);
+                    clients_remove_focus(&lists[l], c);
+                }
+
+                clients_remove_client(&lists[l], c);
+                clients_insert(&lists[target], c);
+                model_insert(&models[target], window);
+                break;
+            }
+        }
+
+        check_all(lists, models, &index, next_window);
+    }
+
+    if (failures)
+        fprintf(stderr, "randomized: failed at step %d with seed %llu\n", step, seed);
+    else
+        printf("randomized: %d steps, %lu windows, seed %llu\n", step, next_window - 1, seed);
+
+    for (int l = 0; l < TOTAL_LISTS; l++)
+        while (lists[l].head)
+            clients_destroy_client(&lists[l], lists[l].head);
+    clients_index_destroy(&index);
+}
+
+static void test_initialize_resets_tail(void)
+{
+    client_index_t index;
+    client_list_t list;
+    clients_index_initialize(&index);
+
+    // Leftovers from whatever used the memory before
+    memset(&list, 0xab, sizeof(list));
+    clients_initialize(&list, &index);
+    CHECK(!list.head && !list.tail && list.length == 0 && !list.focus_stack);
+
+    client_t *c = create_client(1);
+    clients_insert(&list, c);
+    CHECK(list.head == c && list.tail == c);
+
+    clients_destroy_client(&list, c);
+    clients_index_destroy(&index);
+}
+
+static void test_remove_only_and_last(void)
+{
+    client_index_t index;
+    client_list_t list;
+    clients_index_initialize(&index);
+    clients_initialize(&list, &index);
+
+    client_t *only = create_client(1);
+    clients_insert(&list, only);
+    clients_destroy_client(&list, only);
+    CHECK(!list.head && !list.tail && list.length == 0);
+    CHECK(!clients_find_by_window(&index, 1));
+
+    // Inserted at the head, so `first` ends up being the tail
+    client_t *first = create_client(2);
+    client_t *second = create_client(3);
+    clients_insert(&list, first);
+    clients_insert(&list, second);
+    CHECK(list.tail == first);
+
+    clients_destroy_client(&list, first);
+    CHECK(list.head == second && list.tail == second && !second->next && !second->previous);
+
+    clients_destroy_client(&list, second);
+    CHECK(!list.head && !list.tail && index.length == 0);
+    clients_index_destroy(&index);
+}
+
+static void test_focus_after_removal(void)
+{
+    client_index_t index;
+    client_list_t list;
+    clients_index_initialize(&index);
+    clients_initialize(&list, &index);
+
+    client_t *a = create_client(1), *b = create_client(2), *c = create_client(3);
+    clients_insert(&list, a);
+    clients_insert(&list, b);
+    clients_insert(&list, c);
+
+    // Clients that are in the list but were never focused leave no focus behind
+    CHECK(!clients_get_focused(&list) && list.length == 3);
+
+    clients_push_focus(&list, a);
+    clients_push_focus(&list, b);
+    clients_push_focus(&list, c);
+
+    // Destroying the focused client hands the focus back to the previous one
+    clients_destroy_client(&list, c);
+    CHECK(clients_get_focused(&list) == b && !b->focus_previous);
+
+    // Removing an entry from the middle keeps the head untouched
+    clients_push_focus(&list, a);
+    clients_remove_focus(&list, b);
+    CHECK(clients_get_focused(&list) == a && !a->focus_next);
+
+    clients_destroy_client(&list, a);
+    CHECK(!clients_get_focused(&list));
+
+    // Not focused at all, nothing should change
+    clients_remove_focus(&list, b);
+    CHECK(!clients_get_focused(&list) && list.head == b);
+
+    clients_destroy_client(&list, b);
+    clients_index_destroy(&index);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long seed = argc > 1 ? strtoull(argv[1], NULL, 10) : 0x5eed;
+    // xorshift never leaves zero
+    if (seed == 0)
+        seed = 1;
+
+    test_initialize_resets_tail();
+    test_remove_only_and_last();
+    test_focus_after_removal();
+    test_randomized(seed);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All client list tests passed\n");
+    return EXIT_SUCCESS;
+}
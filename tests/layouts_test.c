@@ -0,0 +1,192 @@
+/*
+ * Checks every layout in layouts.c for any number of windows, without an X
+ * server. Rectangles must never be empty or leave the area, since tile()
+ * sends them as they are. Run through `make test`.
+ */
+#include "../src/layouts.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+        return; \
+    } \
+} while (0)
+
+// A monitor with a bar, a monitor without gaps and one that barely holds its gaps
+static const layout_params_t areas[] = {
+    { 1280, 783, 10, 640 },
+    { 800, 600, 0, 400 },
+    { 60, 40, 15, 30 },
+};
+
+static const int totals[] = { 0, 1, 2, 3, 5, 14, 72, 200, 1000, 10000 };
+
+static bool do_overlap(const layout_rect_t *a, const layout_rect_t *b)
+{
+    return a->x < b->x + b->width && b->x < a->x + a->width &&
+        a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+static void check_inside(const layout_params_t *p, layout_e layout, int total)
+{
+    layout_cache_t cache;
+    layout_cache_initialize(&cache);
+
+    const layout_rect_t *rects = layout_compute(&cache, layout, p, total);
+    for (int i = 0; i < total; i++)
+    {
+        const layout_rect_t *r = &rects[i];
+        if (r->width < 1 || r->height < 1 || r->x < 0 || r->y < 0 ||
+            r->x + r->width > p->width || r->y + r->height > p->height)
+        {
+            fprintf(stderr, "%s, %dx%d gap %d, %d windows: rect %d is %dx%d+%d+%d\n",
+                    layout_name(layout), p->width, p->height, p->gap, total, i,
+                    r->width, r->height, r->x, r->y);
+            failures++;
+            break;
+        }
+    }
+
+    layout_cache_destroy(&cache);
+}
+
+static void test_every_size(void)
+{
+    for (int a = 0; a < (int) (sizeof(areas) / sizeof(areas[0])); a++)
+        for (int layout = 0; layout < TOTAL_LAYOUTS; layout++)
+            for (int t = 0; t < (int) (sizeof(totals) / sizeof(totals[0])); t++)
+                check_inside(&areas[a], layout, totals[t]);
+}
+
+// A single window always takes the whole area, minus the gaps
+static void test_single_window(void)
+{
+    const layout_params_t *p = &areas[0];
+
+    for (int layout = 0; layout < TOTAL_LAYOUTS; layout++)
+    {
+        layout_cache_t cache;
+        layout_cache_initialize(&cache);
+
+        const layout_rect_t *r = layout_compute(&cache, layout, p, 1);
+        CHECK(r[0].x == p->gap && r[0].y == p->gap);
+        CHECK(r[0].width == p->width - 2 * p->gap && r[0].height == p->height - 2 * p->gap);
+
+        layout_cache_destroy(&cache);
+    }
+}
+
+// As long as there's room, tiling layouts never put two windows on top of each other
+static void test_no_overlap(void)
+{
+    const layout_params_t *p = &areas[0];
+
+    for (int layout = 0; layout < TOTAL_LAYOUTS; layout++)
+    {
+        if (layout == LAYOUT_MONOCLE)
+            continue;
+
+        for (int total = 2; total <= 8; total++)
+        {
+            layout_cache_t cache;
+            layout_cache_initialize(&cache);
+
+            const layout_rect_t *r = layout_compute(&cache, layout, p, total);
+            for (int i = 0; i < total; i++)
+                for (int j = i + 1; j < total; j++)
+                    CHECK(!do_overlap(&r[i], &r[j]));
+
+            layout_cache_destroy(&cache);
+        }
+    }
+}
+
+static void test_master_stack(void)
+{
+    const layout_params_t *p = &areas[0];
+    layout_cache_t cache;
+    layout_cache_initialize(&cache);
+
+    const layout_rect_t *r = layout_compute(&cache, LAYOUT_MASTER_STACK, p, 2);
+    CHECK(r[0].width == p->special_width);
+    CHECK(r[1].x == p->special_width + 2 * p->gap);
+    CHECK(r[1].x + r[1].width == p->width - p->gap);
+
+    // Far more windows than rows of a single pixel, the extra ones share the last row
+    r = layout_compute(&cache, LAYOUT_MASTER_STACK, p, 1000);
+    CHECK(r[998].y == r[999].y && r[998].height == r[999].height);
+    CHECK(r[1].y < r[2].y);
+
+    // A special width that doesn't leave room for the stack
+    const layout_params_t wide = { 1280, 783, 10, 5000 };
+    r = layout_compute(&cache, LAYOUT_MASTER_STACK, &wide, 2);
+    CHECK(r[1].width >= 1 && r[0].x + r[0].width <= r[1].x);
+
+    layout_cache_destroy(&cache);
+}
+
+static void test_cache(void)
+{
+    const layout_params_t *p = &areas[0];
+    layout_cache_t cache;
+    layout_cache_initialize(&cache);
+
+    // Nothing computed yet, even an empty workspace is a miss
+    CHECK(cache.total == -1);
+    layout_compute(&cache, LAYOUT_GRID, p, 0);
+    CHECK(cache.total == 0);
+
+    // Tampering with the result tells hits, which hand it out again, from misses
+    layout_rect_t *rects = (layout_rect_t*) layout_compute(&cache, LAYOUT_GRID, p, 4);
+    const int capacity = cache.capacity;
+    rects[0].width = -42;
+
+    CHECK(layout_compute(&cache, LAYOUT_GRID, p, 4)[0].width == -42);
+
+    CHECK(layout_compute(&cache, LAYOUT_SPIRAL, p, 4)[0].width > 0);
+    rects[0].width = -42;
+
+    layout_params_t changed = *p;
+    changed.gap++;
+    CHECK(layout_compute(&cache, LAYOUT_SPIRAL, &changed, 4)[0].width > 0);
+    rects[0].width = -42;
+
+    changed.special_width++;
+    CHECK(layout_compute(&cache, LAYOUT_SPIRAL, &changed, 4)[0].width > 0);
+    rects[0].width = -42;
+
+    // Fewer windows is still a miss, but the buffer is kept
+    CHECK(layout_compute(&cache, LAYOUT_SPIRAL, &changed, 3)[0].width > 0);
+    CHECK(cache.capacity == capacity && cache.rects == rects);
+
+    // Growing past the capacity at least doubles it
+    layout_compute(&cache, LAYOUT_SPIRAL, &changed, capacity + 1);
+    CHECK(cache.capacity >= 2 * capacity);
+
+    layout_cache_destroy(&cache);
+    CHECK(!cache.rects && cache.capacity == 0 && cache.total == -1);
+}
+
+int main(void)
+{
+    test_every_size();
+    test_single_window();
+    test_no_overlap();
+    test_master_stack();
+    test_cache();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All layout tests passed\n");
+    return EXIT_SUCCESS;
+}
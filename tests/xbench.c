@@ -0,0 +1,373 @@
+/*
+ * A synthetic X client that puts a running WM through its paces. It maps N
+ * windows one by one, cycles the focus, sends configure requests, resizes
+ * the tiled windows, moves a floating one around, switches workspaces back
+ * and forth and finally destroys every window. Each step is
+ * timed from our side, from the request until we can observe its outcome,
+ * and the WM is asked over IPC how many requests it sent along the way.
+ *
+ * Prints a single line of JSON. Usually driven by tests/bench.sh, through
+ * `make bench`: xbench <ipc socket> <total windows>
+ */
+#include "../src/utils.h"
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Anything slower than this is taken as the WM being stuck
+#define EVENT_TIMEOUT_MS 5000
+// Repetitions for the steps that don't scale with the number of windows
+#define MAX_REPEATS 50
+
+typedef struct
+{
+    long long *samples;
+    int total;
+    unsigned long requests;
+} phase_t;
+
+static Display *conn;
+static int ipc_fd;
+
+static void ipc_connect(const char *path)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+    ipc_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ipc_fd == -1 || connect(ipc_fd, (struct sockaddr*) &address, sizeof(address)) == -1)
+        log_fatal("failed to connect to the WM at %s", path);
+}
+
+// Sends a command and waits for its single line reply
+static void ipc_command(const char *command, char *reply, size_t size)
+{
+    char line[256];
+    const int length = snprintf(line, sizeof(line), "%s\n", command);
+    if (write(ipc_fd, line, length) != length)
+        log_fatal("failed to send '%s' to the WM", command);
+
+    size_t total = 0;
+    while (total + 1 < size)
+    {
+        if (read(ipc_fd, &reply[total], 1) != 1)
+            log_fatal("the WM hung up on '%s'", command);
+        if (reply[total++] == '\n')
+            break;
+    }
+
+    reply[total] = '\0';
+}
+
+static unsigned long wm_requests(void)
+{
+    char reply[512];
+    ipc_command("stats", reply, sizeof(reply));
+
+    const char *requests = strstr(reply, "\"requests\": ");
+    if (!requests)
+        log_fatal("unexpected stats reply: %s", reply);
+
+    return strtoul(requests + strlen("\"requests\": "), NULL, 10);
+}
+
+typedef struct
+{
+    int type;
+    Window window;
+    Atom atom;
+    // Only for ConfigureNotify, whether it was sent by the WM instead of the server
+    bool is_synthetic;
+} event_filter_t;
+
+static Bool matches_filter(Display *display, XEvent *event, XPointer arg)
+{
+    (void) display;
+    const event_filter_t *filter = (const event_filter_t*) arg;
+
+    if (event->type != filter->type)
+        return false;
+
+    switch (event->type)
+    {
+        // Focus moving within one of our windows does not count
+        case FocusIn:
+            return event->xfocus.mode == NotifyNormal && event->xfocus.detail != NotifyInferior &&
+                event->xfocus.detail != NotifyPointer;
+        case PropertyNotify:
+            return event->xproperty.window == filter->window && event->xproperty.atom == filter->atom;
+        case ConfigureNotify:
+            return event->xconfigure.window == filter->window &&
+                (bool) event->xconfigure.send_event == filter->is_synthetic;
+        default:
+            return event->xany.window == filter->window;
+    }
+}
+
+// Blocks until an event matches, without ever hanging for good
+static void wait_for_event(event_filter_t filter, const char *what)
+{
+    XEvent event;
+    const long long deadline = monotonic_time_us() + EVENT_TIMEOUT_MS * 1000LL;
+
+    // XCheckIfEvent flushes our own requests as well
+    while (!XCheckIfEvent(conn, &event, matches_filter, (XPointer) &filter))
+    {
+        const long long left = deadline - monotonic_time_us();
+        if (left <= 0)
+            log_fatal("timed out waiting for %s", what);
+
+        struct pollfd fd = { .fd = ConnectionNumber(conn), .events = POLLIN };
+        poll(&fd, 1, (int) (left / 1000) + 1);
+    }
+}
+
+static void wait_until_viewable(Window window, bool is_viewable)
+{
+    XWindowAttributes attributes;
+    const long long deadline = monotonic_time_us() + EVENT_TIMEOUT_MS * 1000LL;
+
+    // There's no event for a parent being mapped, so just keep asking
+    while (XGetWindowAttributes(conn, window, &attributes) &&
+           (attributes.map_state == IsViewable) != is_viewable)
+    {
+        if (monotonic_time_us() > deadline)
+            log_fatal("timed out waiting for a workspace switch");
+    }
+}
+
+// Events left over from earlier steps must not be mistaken for the next outcome
+static void begin_sample(void)
+{
+    XSync(conn, true);
+}
+
+// A real one, sent by the server once the window actually changed
+static void wait_for_configure(Window window, const char *what)
+{
+    wait_for_event((event_filter_t) { .type = ConfigureNotify, .window = window }, what);
+}
+
+static void start_phase(phase_t *phase, int capacity)
+{
+    phase->samples = malloc(MAX(capacity, 1) * sizeof(long long));
+    if (!phase->samples)
+        log_fatal("failed to allocate memory for samples");
+
+    phase->total = 0;
+    phase->requests = wm_requests();
+}
+
+static void end_phase(phase_t *phase)
+{
+    phase->requests = wm_requests() - phase->requests;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    const long long x = *(const long long*) a, y = *(const long long*) b;
+    return (x > y) - (x < y);
+}
+
+static void print_phase(const char *name, phase_t *phase, bool is_last)
+{
+    printf("\"%s\": ", name);
+    if (phase->total == 0)
+    {
+        printf("null%s", is_last ? "" : ", ");
+        return;
+    }
+
+    qsort(phase->samples, phase->total, sizeof(long long), compare_samples);
+
+    long long sum = 0;
+    for (int i = 0; i < phase->total; i++)
+        sum += phase->samples[i];
+
+    printf("{\"count\": %d, \"mean_us\": %lld, \"p50_us\": %lld, \"max_us\": %lld, "
+           "\"requests_per_op\": %.1f}%s", phase->total, sum / phase->total,
+           phase->samples[phase->total / 2], phase->samples[phase->total - 1],
+           (double) phase->requests / phase->total, is_last ? "" : ", ");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+        log_fatal("usage: %s <ipc socket> <total windows>", argv[0]);
+
+    const int total = atoi(argv[2]);
+    if (total < 1)
+        log_fatal("at least one window is needed");
+
+    conn = XOpenDisplay(NULL);
+    if (!conn)
+        log_fatal("failed to connect to X server: %s", XDisplayName(NULL));
+
+    ipc_connect(argv[1]);
+
+    const Window root = DefaultRootWindow(conn);
+    const Atom client_list = XInternAtom(conn, "_NET_CLIENT_LIST", false);
+    const Atom window_type = XInternAtom(conn, "_NET_WM_WINDOW_TYPE", false);
+    const Atom dialog_type = XInternAtom(conn, "_NET_WM_WINDOW_TYPE_DIALOG", false);
+    XSelectInput(conn, root, PropertyChangeMask);
+
+    Window *windows = malloc(total * sizeof(Window));
+    if (!windows)
+        log_fatal("failed to allocate memory for windows");
+
+    /*
+     * Mapped one at a time, so every sample pays for a relayout of all the
+     * previous ones. A sample ends once the new window is mapped at its tiled
+     * position and the window before it was moved out of the master pane,
+     * which the new one always takes over in the default layout
+     */
+    phase_t map;
+    start_phase(&map, total);
+    for (int i = 0; i < total; i++)
+    {
+        windows[i] = XCreateSimpleWindow(conn, root, 0, 0, 200, 200, 0, 0, 0);
+        XSelectInput(conn, windows[i], StructureNotifyMask | FocusChangeMask);
+
+        begin_sample();
+        const long long start = monotonic_time_us();
+        XMapWindow(conn, windows[i]);
+        wait_for_event((event_filter_t) { .type = MapNotify, .window = windows[i] }, "a map");
+        wait_for_configure(windows[i], "the tiled position of a new window");
+        if (i > 0)
+            wait_for_configure(windows[i - 1], "the relayout after a map");
+        map.samples[map.total++] = monotonic_time_us() - start;
+    }
+    end_phase(&map);
+
+    // Cycling through a single window does not move the focus anywhere
+    phase_t focus;
+    const int focus_repeats = total > 1 ? MIN(total, MAX_REPEATS) : 0;
+    start_phase(&focus, focus_repeats);
+    for (int i = 0; i < focus_repeats; i++)
+    {
+        char reply[64];
+        begin_sample();
+        const long long start = monotonic_time_us();
+        ipc_command("focus-next", reply, sizeof(reply));
+        wait_for_event((event_filter_t) { .type = FocusIn }, "a focus change");
+        focus.samples[focus.total++] = monotonic_time_us() - start;
+    }
+    end_phase(&focus);
+
+    // Tiled windows are not moved, they're answered with a synthetic ConfigureNotify
+    phase_t configure_tiled;
+    const int configure_repeats = MIN(total, MAX_REPEATS);
+    start_phase(&configure_tiled, configure_repeats);
+    for (int i = 0; i < configure_repeats; i++)
+    {
+        begin_sample();
+        const long long start = monotonic_time_us();
+        XMoveResizeWindow(conn, windows[i], 10 + i, 10 + i, 300 + i, 300 + i);
+        wait_for_event((event_filter_t) {
+            .type = ConfigureNotify, .window = windows[i], .is_synthetic = true
+        }, "the answer to a configure request");
+        configure_tiled.samples[configure_tiled.total++] = monotonic_time_us() - start;
+    }
+    end_phase(&configure_tiled);
+
+    /*
+     * Growing and shrinking the master pane resizes every tiled window. The
+     * newest window is the special one and is configured first, the oldest
+     * one is in the stack and is configured last. A single window takes up
+     * the whole monitor no matter the special width
+     */
+    phase_t resize;
+    const int resize_repeats = total > 1 ? MAX_REPEATS : 0;
+    start_phase(&resize, resize_repeats);
+    for (int i = 0; i < resize_repeats; i++)
+    {
+        char reply[64];
+        begin_sample();
+        const long long start = monotonic_time_us();
+        ipc_command(i % 2 ? "adjust-special-width -20" : "adjust-special-width 20",
+                reply, sizeof(reply));
+        wait_for_configure(windows[total - 1], "the special window to be resized");
+        wait_for_configure(windows[0], "the stack to be resized");
+        resize.samples[resize.total++] = monotonic_time_us() - start;
+    }
+    end_phase(&resize);
+
+    // Dialogs float, so the WM grants their requests with real moves and resizes
+    Window dialog = XCreateSimpleWindow(conn, root, 0, 0, 200, 200, 0, 0, 0);
+    XChangeProperty(conn, dialog, window_type, XA_ATOM, 32, PropModeReplace,
+            (unsigned char*) &dialog_type, 1);
+    XSelectInput(conn, dialog, StructureNotifyMask);
+    XMapWindow(conn, dialog);
+    wait_for_event((event_filter_t) { .type = MapNotify, .window = dialog }, "a dialog");
+
+    phase_t configure_floating;
+    start_phase(&configure_floating, MAX_REPEATS);
+    for (int i = 0; i < MAX_REPEATS; i++)
+    {
+        begin_sample();
+        const long long start = monotonic_time_us();
+        XMoveResizeWindow(conn, dialog, 50 + i, 50 + i, 300 + i, 200 + i);
+        wait_for_configure(dialog, "a floating window to be configured");
+        configure_floating.samples[configure_floating.total++] = monotonic_time_us() - start;
+    }
+    end_phase(&configure_floating);
+
+    begin_sample();
+    XDestroyWindow(conn, dialog);
+    wait_for_event((event_filter_t) {
+        .type = PropertyNotify, .window = root, .atom = client_list
+    }, "the client list");
+
+    // Away to an empty workspace and back, each way is a sample of its own
+    phase_t switches;
+    start_phase(&switches, 2 * MAX_REPEATS);
+    for (int i = 0; i < 2 * MAX_REPEATS; i++)
+    {
+        char reply[64];
+        const bool is_returning = (i % 2 == 1);
+
+        begin_sample();
+        const long long start = monotonic_time_us();
+        ipc_command(is_returning ? "switch-to-workspace 0" : "switch-to-workspace 1",
+                reply, sizeof(reply));
+        wait_until_viewable(windows[0], is_returning);
+        switches.samples[switches.total++] = monotonic_time_us() - start;
+    }
+    end_phase(&switches);
+
+    // The client list on the root is only rewritten once the WM let go of the window
+    phase_t destroy;
+    start_phase(&destroy, total);
+    for (int i = 0; i < total; i++)
+    {
+        begin_sample();
+        const long long start = monotonic_time_us();
+        XDestroyWindow(conn, windows[i]);
+        wait_for_event((event_filter_t) {
+            .type = PropertyNotify, .window = root, .atom = client_list
+        }, "the client list");
+        destroy.samples[destroy.total++] = monotonic_time_us() - start;
+    }
+    end_phase(&destroy);
+
+    printf("{\"clients\": %d, ", total);
+    print_phase("map", &map, false);
+    print_phase("focus", &focus, false);
+    print_phase("configure_tiled", &configure_tiled, false);
+    print_phase("resize", &resize, false);
+    print_phase("configure_floating", &configure_floating, false);
+    print_phase("switch", &switches, false);
+    print_phase("destroy", &destroy, true);
+    printf("}\n");
+
+    XCloseDisplay(conn);
+    close(ipc_fd);
+    return EXIT_SUCCESS;
+}